@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db.h"
+
+// benchmark of the engine, linked against the same library as the REPL.
+// it inserts rows in id order and in random order, then looks rows up
+// and scans the whole table, each once against a cold cache and again
+// against a warm one. every workload times each of its operations and
+// the results are printed as json: the throughput and the 50th, 99th
+// and 99.9th percentile of the latencies, in nanoseconds
+
+// what a run is asked to do, set on the command line
+typedef struct {
+  char *filename;
+  uint32_t num_rows;
+  uint32_t num_lookups;
+  uint32_t num_scans;
+  uint64_t seed;
+  DbOptions options;
+} BenchOptions;
+
+uint64_t now_ns() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// xorshift, so a run is repeated exactly for the same seed
+uint64_t next_random(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+int compare_latencies(const void *a, const void *b) {
+  uint64_t left = *(const uint64_t *)a;
+  uint64_t right = *(const uint64_t *)b;
+  return (left > right) - (left < right);
+}
+
+// the latency below which the given fraction of the operations finished
+uint64_t percentile(uint64_t *latencies, uint32_t count, double fraction) {
+  uint32_t index = (uint32_t)(fraction * count + 0.5);
+  if (index > 0) {
+    index -= 1;
+  }
+  return latencies[index < count ? index : count - 1];
+}
+
+// prints the result of one workload. latencies holds the time each of
+// the count operations took, elapsed the time of the whole workload
+void report(char *name, uint64_t *latencies, uint32_t count,
+            uint64_t elapsed, bool first) {
+  qsort(latencies, count, sizeof(uint64_t), compare_latencies);
+  double seconds = elapsed / 1e9;
+  printf("%s    {\"name\": \"%s\", \"ops\": %u, \"seconds\": %.6f, "
+         "\"ops_per_sec\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+         "\"p999_ns\": %llu}",
+         first ? "" : ",\n", name, count, seconds,
+         seconds > 0 ? count / seconds : 0,
+         (unsigned long long)percentile(latencies, count, 0.5),
+         (unsigned long long)percentile(latencies, count, 0.99),
+         (unsigned long long)percentile(latencies, count, 0.999));
+}
+
+// writes the database file back and asks the kernel to drop it from the
+// page cache, so the next open reads every page from the disk again.
+// the kernel is free to keep some of them, a cold run is a best effort
+void drop_file_cache(char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+// closes the database and opens it again with an empty buffer pool
+Table *reopen_cold(Table *table, BenchOptions *bench) {
+  db_close(table);
+  drop_file_cache(bench->filename);
+  return db_open(bench->filename, &bench->options);
+}
+
+void fill_row(Row *row, uint32_t id) {
+  row->id = id;
+  snprintf(row->username, sizeof(row->username), "user%u", id);
+  snprintf(row->email, sizeof(row->email), "user%u@example.com", id);
+}
+
+// inserts the ids in the order given into a new database, which is left
+// open for the workloads after it
+Table *bench_insert(BenchOptions *bench, char *name, uint32_t *ids,
+                    uint64_t *latencies, bool first) {
+  unlink(bench->filename);
+  Table *table = db_open(bench->filename, &bench->options);
+  uint64_t start = now_ns();
+  for (uint32_t i = 0; i < bench->num_rows; i++) {
+    Row row;
+    fill_row(&row, ids[i]);
+    uint64_t begin = now_ns();
+    ExecuteResult result = table_insert(table, &row);
+    latencies[i] = now_ns() - begin;
+    if (result != EXECUTE_SUCCESS) {
+      printf("Error inserting row %u.\n", ids[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  report(name, latencies, bench->num_rows, now_ns() - start, first);
+  return table;
+}
+
+// looks up ids picked at random, the same ones for the same seed
+void bench_lookup(BenchOptions *bench, Table *table, char *name,
+                  uint64_t *latencies) {
+  uint64_t state = bench->seed;
+  uint64_t start = now_ns();
+  for (uint32_t i = 0; i < bench->num_lookups; i++) {
+    uint32_t id = next_random(&state) % bench->num_rows + 1;
+    Row row;
+    uint64_t begin = now_ns();
+    bool found = table_get(table, id, &row);
+    latencies[i] = now_ns() - begin;
+    if (!found) {
+      printf("Error looking up row %u.\n", id);
+      exit(EXIT_FAILURE);
+    }
+  }
+  report(name, latencies, bench->num_lookups, now_ns() - start, false);
+}
+
+void count_scanned_row(Row *row, void *argument) {
+  (void)row;
+  *(uint64_t *)argument += 1;
+}
+
+// reads every row of the table, once per operation
+void bench_scan(BenchOptions *bench, Table *table, char *name,
+                uint32_t num_scans, uint64_t *latencies) {
+  uint64_t start = now_ns();
+  for (uint32_t i = 0; i < num_scans; i++) {
+    uint64_t count = 0;
+    uint64_t begin = now_ns();
+    table_scan(table, 0, UINT32_MAX, count_scanned_row, &count);
+    latencies[i] = now_ns() - begin;
+    if (count != bench->num_rows) {
+      printf("Error scanning, found %llu rows.\n", (unsigned long long)count);
+      exit(EXIT_FAILURE);
+    }
+  }
+  report(name, latencies, num_scans, now_ns() - start, false);
+}
+
+int main(int argc, char *argv[]) {
+  BenchOptions bench;
+  bench.filename = "bench.db";
+  bench.num_rows = 100000;
+  bench.num_lookups = 0;
+  bench.num_scans = 5;
+  bench.seed = 1;
+  db_default_options(&bench.options);
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--rows") == 0) {
+      bench.num_rows = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--lookups") == 0) {
+      bench.num_lookups = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--scans") == 0) {
+      bench.num_scans = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      bench.seed = strtoull(argv[i + 1], NULL, 10);
+    } else if (strcmp(argv[i], "--file") == 0) {
+      bench.filename = argv[i + 1];
+    } else if (strcmp(argv[i], "--frames") == 0) {
+      bench.options.pool_frames = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--page-size") == 0) {
+      bench.options.page_size = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--wal") == 0) {
+      bench.options.wal = strcmp(argv[i + 1], "on") == 0;
+    } else {
+      printf("Unknown option '%s'.\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (bench.num_rows < 1 || bench.num_scans < 1) {
+    printf("A benchmark needs at least one row and one scan.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (bench.num_lookups == 0) {
+    bench.num_lookups = bench.num_rows;
+  }
+  // a seed of 0 would keep xorshift at 0 forever
+  if (bench.seed == 0) {
+    bench.seed = 1;
+  }
+
+  uint32_t most_ops = bench.num_rows;
+  if (bench.num_lookups > most_ops) {
+    most_ops = bench.num_lookups;
+  }
+  if (bench.num_scans > most_ops) {
+    most_ops = bench.num_scans;
+  }
+  uint64_t *latencies = malloc(most_ops * sizeof(uint64_t));
+  uint32_t *ids = malloc(bench.num_rows * sizeof(uint32_t));
+
+  printf("{\n  \"rows\": %u,\n  \"lookups\": %u,\n  \"frames\": %u,\n"
+         "  \"workloads\": [\n",
+         bench.num_rows, bench.num_lookups, bench.options.pool_frames);
+
+  for (uint32_t i = 0; i < bench.num_rows; i++) {
+    ids[i] = i + 1;
+  }
+  Table *table =
+      bench_insert(&bench, "insert_sequential", ids, latencies, true);
+  db_close(table);
+
+  // the same ids shuffled, this table is the one the reads run against
+  uint64_t state = bench.seed;
+  for (uint32_t i = bench.num_rows - 1; i > 0; i--) {
+    uint32_t j = next_random(&state) % (i + 1);
+    uint32_t id = ids[i];
+    ids[i] = ids[j];
+    ids[j] = id;
+  }
+  table = bench_insert(&bench, "insert_random", ids, latencies, false);
+
+  table = reopen_cold(table, &bench);
+  bench_lookup(&bench, table, "lookup_cold", latencies);
+  bench_lookup(&bench, table, "lookup_warm", latencies);
+
+  table = reopen_cold(table, &bench);
+  bench_scan(&bench, table, "scan_cold", 1, latencies);
+  bench_scan(&bench, table, "scan_warm", bench.num_scans, latencies);
+
+  db_close(table);
+  unlink(bench.filename);
+  printf("\n  ]\n}\n");
+  free(ids);
+  free(latencies);
+  return EXIT_SUCCESS;
+}
@@ -1,69 +1,56 @@
+#define _GNU_SOURCE
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
-// struct which holds the bytes read from stdin,
-// the length of buffer and input length
-typedef struct {
-  char *buffer;
-  size_t buffer_length;
-  ssize_t input_length;
-} InputBuffer;
-
-// defines types for statement execution
-typedef enum {
-  EXECUTE_SUCCESS,
-  EXECUTE_TABLE_FULL,
-  EXECUTE_DUPLICATE_KEY
-} ExecuteResult;
-
-// defines types for meta command
-typedef enum {
-  META_COMMAND_SUCCESS,
-  META_COMMAND_UNRECOGNIZED_COMMAND
-} MetaCommandResult;
-
-// defines types for statement commands
-typedef enum {
-  PREPARE_SUCCESS,
-  PREPARE_SYNTAX_ERROR,
-  PREPARE_UNRECOGNIZED_STATEMENT,
-  PREPARE_STRING_TOO_LONG,
-  PREPARE_NEGATIVE_ID
-} PrepareResult;
-
-// defines types for statements, will grow over time
-typedef enum { STATEMENT_INSERT, STATEMENT_SELECT } StatementType;
+#include "db.h"
 
 // defining types for nodes
 typedef enum { NODE_INTERNAL, NODE_LEAF } NodeType;
 
-// constant for schema
-#define COLUMN_USERNAME_SIZE 32
-#define COLUMN_EMAIL_SIZE 255
+// formats a select can write its rows in. text is what the REPL always
+// printed, csv is one "id,username,email" line per row and binary is
+// the fixed size record of binary load files, so an export can be
+// loaded again
+typedef enum { OUTPUT_TEXT, OUTPUT_CSV, OUTPUT_BINARY } OutputFormat;
 
-// fixed row schema
-typedef struct {
-  uint32_t id;
-  char username[COLUMN_USERNAME_SIZE + 1];
-  char email[COLUMN_EMAIL_SIZE + 1];
-} Row;
+// where select sends its rows. rows are formatted by hand into buffer,
+// which is written to fd when it runs full and after every statement,
+// stdio is not involved
+#define RESULT_BUFFER_SIZE (1 << 20)
 
-// creating a statement dict to keep track of types
-typedef struct {
-  StatementType type;
-  Row row_to_insert;
-} Statement;
+struct ResultSink {
+  int fd;
+  OutputFormat format;
+  char *buffer;
+  uint32_t length;
+};
 
 // representation bits for calculating size
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
 
-// defining size and offsets of cells in row
+// defining size and offsets of the fixed size row record used by binary
+// load files
 const uint32_t ID_SIZE = size_of_attribute(Row, id);
 const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
 const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
@@ -72,11 +59,42 @@ const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
 const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
 const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
 
-// defining page and maximum pages for a table
-const uint32_t PAGE_SIZE = 4096;
-#define TABLE_MAX_PAGES 100
+// the page size is picked when a database file is created and recorded
+// in its header. slot offsets are 16 bits, which caps pages at 64KB.
+// defining the default page size and the default size of the buffer pool
+#define DEFAULT_PAGE_SIZE 4096
+#define MAX_PAGE_SIZE 65536
+#define DEFAULT_POOL_FRAMES 100
+
+// page 0 of a database file is a header naming the file format, the
+// page size, the root page of the tree, the head of the freelist and the
+// root pages of the indexes, 0 for a column without one. an index being
+// built has its bit set in building_indexes until it is complete
+#define FILE_HEADER_MAGIC "DBHEADER"
+#define FILE_FORMAT_VERSION 2
 
-// defining constants for node header layout
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t page_size;
+  uint32_t root_page_num;
+  uint32_t freelist_trunk;
+  uint32_t num_free_pages;
+  uint32_t index_root_page_nums[NUM_STRING_COLUMNS];
+  uint32_t building_indexes;
+} FileHeader;
+
+// pages nobody uses any more are kept on a freelist. a trunk page holds
+// the page number of the next trunk and the numbers of free leaf pages,
+// the contents of the leaf pages themselves are never looked at
+const uint32_t FREELIST_TRUNK_NEXT_OFFSET = 0;
+const uint32_t FREELIST_TRUNK_NUM_LEAVES_OFFSET = sizeof(uint32_t);
+const uint32_t FREELIST_TRUNK_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+// defining constants for node header layout.
+// the parent pointer is not maintained, parents are found through the
+// path a cursor records on its way down, so a split never has to rewrite
+// the pages of the children it moves
 const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
 const uint32_t NODE_TYPE_OFFSET = 0;
 const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
@@ -86,27 +104,38 @@ const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
 const uint8_t COMMON_NODE_HEADER_SIZE =
     NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
 
-// constants for leaf node layout
+// constants for leaf node layout. cell content grows down from the end
+// of the page, content_start is where it begins. fragmented counts the
+// bytes of cells which were moved away and can be reclaimed by compacting
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET =
+    LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_CONTENT_START_OFFSET =
+    LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_FRAGMENTED_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_FRAGMENTED_OFFSET =
+    LEAF_NODE_CONTENT_START_OFFSET + LEAF_NODE_CONTENT_START_SIZE;
 const uint32_t LEAF_NODE_HEADER_SIZE =
-    COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE;
-
-// constants for node body layout
+    COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE +
+    LEAF_NODE_NEXT_LEAF_SIZE + LEAF_NODE_CONTENT_START_SIZE +
+    LEAF_NODE_FRAGMENTED_SIZE;
+
+// constants for node body layout. a slot directory sorted by key follows
+// the header, the keys of the cells in one array and then their offsets
+// in another. the id of a row is its key, the cell holds the rest of
+// the row: the username and the email each prefixed with their length,
+// so a cell takes only as much space as its row needs
 const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET =
-    LEAF_NODE_KEY_OFFSET + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS =
-    LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-
-// leaf node size constants
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT =
-    (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
+const uint32_t LEAF_NODE_OFFSET_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_OFFSET_SIZE;
+const uint32_t LEAF_NODE_LENGTH_SIZE = sizeof(uint8_t);
+const uint32_t LEAF_NODE_MAX_CELL_SIZE = LEAF_NODE_LENGTH_SIZE +
+                                         COLUMN_USERNAME_SIZE +
+                                         LEAF_NODE_LENGTH_SIZE +
+                                         COLUMN_EMAIL_SIZE;
 
 // internal node header layout
 const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
@@ -118,54 +147,512 @@ const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
                                            INTERNAL_NODE_NUM_KEYS_SIZE +
                                            INTERNAL_NODE_RIGHT_CHILD_SIZE;
 
-// internal node body layout
+// internal node body layout, the keys in one array and then the children
+// to their left in another
 const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CELL_SIZE =
     INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
 
+// marks an empty hash bucket / end of a hash chain in the buffer pool
+#define INVALID_FRAME UINT32_MAX
+
+// a frame is one slot of the buffer pool which can hold a single page.
+// pinned frames are in use by someone and can not be evicted, the
+// referenced bit is the second chance bit used by the CLOCK sweep and
+// dirty frames hold changes which have not been written to the disk yet.
+// loading frames are being read into without the pager lock held. the
+// latch guards the node in the frame against threads walking the tree
+typedef struct {
+  void *data;
+  uint32_t page_num;
+  uint32_t pin_count;
+  uint32_t hash_next;
+  bool in_use;
+  bool referenced;
+  bool dirty;
+  bool in_txn;
+  bool loading;
+  pthread_rwlock_t latch;
+} Frame;
+
+// read-ahead: a small pool of threads reads the pages a sequential scan
+// is about to visit into frames of the buffer pool, so the scan finds
+// them cached instead of waiting for one read after the other.
+// the queue holds frame numbers, the frames already know their page
+#define READ_AHEAD_THREADS 4
+#define READ_AHEAD_PAGES 32
+#define MAX_READ_AHEAD_PAGES 1024
+
+// workers a parallel scan runs on at most, it takes one per cpu unless
+// told otherwise. the key space is cut into this many ranges per worker
+// so a worker that finishes early can take over the rest
+#define MAX_SCAN_THREADS 64
+#define SCAN_RANGES_PER_THREAD 4
+
+// latencies are counted in buckets of powers of two nanoseconds, bucket
+// i holds the ones below 2^i, the last one everything slower
+#define LATENCY_BUCKETS 40
+
+typedef struct {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+// what the engine has been doing since the database was opened. any
+// thread bumps the counters with relaxed atomics, so a reader may see
+// one counter a little ahead of another. the struct holds nothing but
+// uint64_t counters, which is how stats_snapshot copies it
+typedef struct {
+  uint64_t page_hits;
+  uint64_t page_misses;
+  uint64_t pages_read;
+  uint64_t bytes_read;
+  uint64_t pages_written;
+  uint64_t bytes_written;
+  LatencyHistogram checkpoint;
+  LatencyHistogram sync;
+  LatencyHistogram insert;
+  LatencyHistogram select;
+} Stats;
+
+// the threads hand the frames they filled back to the pager
+typedef struct Pager Pager;
+
+typedef struct {
+  pthread_t threads[READ_AHEAD_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t requested;
+  Pager *pager;
+  uint32_t *queue;
+  uint32_t queue_capacity;
+  uint32_t queue_head;
+  uint32_t queue_length;
+  bool stop;
+} ReadAhead;
+
+// write-ahead log kept next to the database file.
+// every statement appends the images of the pages it changed followed by
+// a commit marker, the log is fsynced once per group of commits and is
+// replayed into the database file by the next db_open after a crash
+typedef struct {
+  int file_descriptor;
+  char *path;
+  uint32_t num_frames;
+  uint32_t unsynced_commits;
+  uint32_t group_commit;
+  uint32_t page_size;
+  void *buffer;
+  uint32_t buffer_capacity;
+  uint32_t buffer_length;
+  LatencyHistogram *sync_latency;
+} Wal;
+
+// every log frame starts with the page number, a non zero commit flag
+// on the last frame of a statement and a checksum over both and the page
+#define WAL_FRAME_HEADER_SIZE (3 * sizeof(uint32_t))
+#define WAL_FRAME_SIZE(wal) (WAL_FRAME_HEADER_SIZE + (wal)->page_size)
+// a checkpoint runs on its own once the log holds this many frames
+#define WAL_AUTOCHECKPOINT_FRAMES 1000
+
+// address space reserved up front by the mmap pager, the mapping only
+// grows (in place) once the file gets larger than this
+#define MMAP_RESERVE_BYTES (1ULL << 32)
+// the mmap pager has no frames to keep latches in, its latches are
+// allocated in chunks of this many pages
+#define MAP_LATCH_CHUNK 1024
+
+// compressed database files start with a header naming the file format
+// and pointing at the page map, which records where the compressed image
+// of every page is stored. the header takes the place of a page so the
+// pages written after it stay aligned
+#define COMPRESSED_MAGIC "DBLZPAGE"
+#define COMPRESSED_HEADER_SIZE 4096
+// compressed pages are stored in extents of whole granules, so a page
+// that grows a little when it is written again still fits in place
+#define COMPRESSED_GRANULE 128
+
+typedef struct {
+  char magic[8];
+  uint32_t page_size;
+  uint32_t num_pages;
+  uint32_t map_length;
+  uint64_t map_offset;
+} CompressedHeader;
+
+// a run of bytes in a compressed database file
+typedef struct {
+  uint64_t offset;
+  uint32_t length;
+} Extent;
+
+// where the pages of a compressed database file live. pages is indexed
+// by page number, a length of 0 marks a page which was never written.
+// a page only moves when it outgrows its extent and the space it leaves
+// behind joins the free extents, which are sorted by offset
+typedef struct {
+  Extent *pages;
+  uint32_t num_pages;
+  uint32_t capacity;
+  Extent map;
+  Extent *free;
+  uint32_t num_free;
+  uint64_t file_end;
+  uint32_t page_size;
+  uint8_t *buffer;
+} PageMap;
+
 // pager abstraction
 // pager acts as a cache, if it doesnt find the page number,
-// it loads it from the disk, also responsible for writing to the disk
-typedef struct {
+// it loads it from the disk, also responsible for writing to the disk.
+// pages live in a fixed number of frames, a page number -> frame hash
+// table finds cached pages and CLOCK eviction makes room for new ones.
+// every thread using the table shares the pager, lock guards the hash
+// table, the frame bookkeeping and the rest of the pager state. reads
+// into loading frames happen without it, loaded is signalled after them
+struct Pager {
+  pthread_mutex_t lock;
+  pthread_cond_t loaded;
+  uint32_t num_loading;
   int file_descriptor;
   uint32_t file_length;
   uint32_t num_pages;
-  void *pages[TABLE_MAX_PAGES];
-} Pager;
+  uint32_t num_frames;
+  Frame *frames;
+  uint32_t clock_hand;
+  uint32_t num_buckets;
+  uint32_t *buckets;
+  uint32_t num_dirty;
+  uint32_t checkpoint_pages;
+  uint32_t checkpoint_seconds;
+  time_t last_checkpoint;
+  Wal *wal;
+  uint32_t *txn_pages;
+  uint32_t txn_num_pages;
+  uint32_t txn_capacity;
+  void *map;
+  size_t map_capacity;
+  uint8_t *dirty_map;
+  uint32_t dirty_map_capacity;
+  PageMap *page_map;
+  uint32_t page_size;
+  uint32_t leaf_node_space_for_cells;
+  uint32_t internal_node_max_keys;
+  uint32_t leaf_node_min_fill;
+  uint32_t internal_node_min_keys;
+  uint32_t freelist_trunk_max_leaves;
+  ReadAhead *read_ahead;
+  uint32_t read_ahead_pages;
+  pthread_rwlock_t **map_latches;
+  uint32_t num_map_latch_chunks;
+  Stats stats;
+};
+
+// server mode listens on a unix socket or on a loopback tcp port. every
+// request and every response is a frame, a 4 byte length followed by
+// that many bytes of body. a request body starts with its RequestType,
+// a response body with a status byte, the ExecuteResult of the request,
+// followed by the rows it returned. rows travel serialized, the id and
+// then both strings with a length byte in front like in a leaf cell.
+// numbers are little endian like in the db file
+typedef enum {
+  REQUEST_INSERT = 1,  // a 4 byte row count and the rows
+  REQUEST_GET,         // an id, answered with the row
+  REQUEST_SCAN,        // the first and last id, answered with a 4 byte
+                       // row count and the rows
+  REQUEST_DELETE,      // an id
+  REQUEST_UPDATE       // a row
+} RequestType;
+
+// status of a request that could not be decoded
+#define RESPONSE_BAD_REQUEST 0xff
+// a longer frame closes the connection
+#define SERVER_MAX_FRAME (1 << 20)
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_SIZE 65536
+// a wakeup reads at most SERVER_READ_BUDGET bytes from a client before
+// the others get their turn, and once the answers of a client pass
+// SERVER_MAX_OUTPUT they are sent before any more of its requests run
+#define SERVER_READ_BUDGET (4 * SERVER_READ_SIZE)
+#define SERVER_MAX_OUTPUT (1 << 20)
+
+// bytes received from a client or waiting to be sent to it
+typedef struct {
+  uint8_t *data;
+  size_t length;
+  size_t capacity;
+} ByteBuffer;
+
+// a client may send requests without waiting for the answers. the
+// complete frames in input are answered in order into output, which is
+// sent in one go once they are used up or output is full. frames that
+// did not fit wait in input until output is sent. output_sent counts
+// the bytes of output the socket has taken so far
+typedef struct {
+  int fd;
+  ByteBuffer input;
+  ByteBuffer output;
+  size_t output_sent;
+} Connection;
+
+// a thread which appends the stats as a line of json to file every
+// interval seconds, until stop is set
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t stop_requested;
+  bool stop;
+  FILE *file;
+  uint32_t interval;
+  Table *table;
+} StatsDump;
 
-// currently we use array based paging
+// the shape of a tree: its height, how many nodes of each kind it has
+// and how many bytes of the leaves hold cells
 typedef struct {
+  uint64_t height;
+  uint64_t num_leaves;
+  uint64_t num_internal;
+  uint64_t leaf_bytes_used;
+} TreeShape;
+
+// buckets of value hashes an index keeps a room hint for
+#define INDEX_ROOM_HINTS 256
+
+// currently we use array based paging.
+// any number of threads may read the table at once, writers take turns
+// on write_lock, which readers never wait for.
+// the number of rows is counted once it is first asked for and from then
+// on kept up to date by the writers, under count_lock. the shape of the
+// tree is walked once the same way and then kept by the writers too,
+// which count the splits of the tree as well.
+// an index is a tree of its own in the same file, it gets a Table of its
+// own as well, which shares the pager and names the column it covers.
+// room_hints remembers the slot an index last added an id to, for every
+// bucket of value hashes
+struct Table {
   Pager *pager;
   uint32_t root_page_num;
-} Table;
-
-// cursor to keep track of which row we are at
+  uint32_t fill_percent;
+  pthread_mutex_t write_lock;
+  uint32_t scan_threads;
+  pthread_mutex_t count_lock;
+  bool row_count_known;
+  uint64_t row_count;
+  bool shape_known;
+  TreeShape shape;
+  uint64_t leaf_splits;
+  uint64_t internal_splits;
+  StringColumn column;
+  Table *indexes[NUM_STRING_COLUMNS];
+  uint32_t room_hints[INDEX_ROOM_HINTS];
+  StatsDump *stats_dump;
+};
+
+// deepest tree we can descend, far more than a 32 bit key space needs
+#define BTREE_MAX_DEPTH 32
+
+// how a thread holds the latch of a node, shared with other readers or
+// alone
+typedef enum { LATCH_SHARED, LATCH_EXCLUSIVE } LatchMode;
+
+// what a descent latches. readers share every node and let go of a
+// parent once they hold the child, a scan keeps the parent of the leaf
+// as well to read ahead from it. a writer that stays inside its leaf
+// does the same but holds the leaf alone. a writer that may split or
+// merge nodes holds the nodes on the path alone and lets go of the
+// ancestors of a node which takes the change without splitting or
+// merging itself, the exclusive descent keeps the whole path
+typedef enum {
+  DESCEND_READ,
+  DESCEND_SCAN,
+  DESCEND_WRITE_LEAF,
+  DESCEND_INSERT,
+  DESCEND_DELETE,
+  DESCEND_EXCLUSIVE
+} Descent;
+
+// cursor to keep track of which row we are at.
+// path holds the internal nodes passed on the way down from the root,
+// a split walks it back up to find the parents of the leaf.
+// leaf_max_key is the largest key the parents route to this leaf.
+// a cursor from table_seek holds the latches of the pages in
+// latched_pages, oldest first, until it is closed
 typedef struct {
   Table *table;
   uint32_t page_num;
   uint32_t cell_num;
-  bool end_of_table;
+  uint32_t path[BTREE_MAX_DEPTH];
+  uint32_t depth;
+  uint32_t leaf_max_key;
+  uint32_t num_latched;
+  uint32_t latched_pages[BTREE_MAX_DEPTH + 2];
+  pthread_rwlock_t *latches[BTREE_MAX_DEPTH + 2];
 } Cursor;
 
+uint64_t stats_now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+void stats_add(uint64_t *counter, uint64_t amount) {
+  __atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+}
+
+// counts the time since start, a value of stats_now, into histogram
+void latency_record(LatencyHistogram *histogram, uint64_t start) {
+  uint64_t elapsed = stats_now() - start;
+  uint32_t bucket = elapsed == 0 ? 0 : 64 - __builtin_clzll(elapsed);
+  if (bucket >= LATENCY_BUCKETS) {
+    bucket = LATENCY_BUCKETS - 1;
+  }
+  stats_add(&histogram->buckets[bucket], 1);
+  stats_add(&histogram->count, 1);
+  stats_add(&histogram->total_ns, elapsed);
+  uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+  while (elapsed > max &&
+         !__atomic_compare_exchange_n(&histogram->max_ns, &max, elapsed, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+// the latency below which the given fraction of the histogram lies,
+// rounded up to the bound of its bucket but never above the largest
+uint64_t latency_percentile(LatencyHistogram *histogram, double fraction) {
+  uint64_t rank = (uint64_t)(fraction * histogram->count + 0.999999);
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= rank && seen > 0) {
+      uint64_t bound = i == 0 ? 0 : (uint64_t)1 << i;
+      return bound < histogram->max_ns ? bound : histogram->max_ns;
+    }
+  }
+  return histogram->max_ns;
+}
+
+// copies the counters while other threads keep bumping them
+void stats_snapshot(Stats *stats, Stats *copy) {
+  uint64_t *from = (uint64_t *)stats;
+  uint64_t *to = (uint64_t *)copy;
+  for (size_t i = 0; i < sizeof(Stats) / sizeof(uint64_t); i++) {
+    to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+  }
+}
+
 // pointer to location after reeserving for headers
 uint32_t *leaf_node_num_cells(void *node) {
   return node + LEAF_NODE_NUM_CELLS_OFFSET;
 }
 
+// pointer to the page number of the leaf to the right of this one,
+// 0 marks the rightmost leaf since page 0 is the file header
+uint32_t *leaf_node_next_leaf(void *node) {
+  return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+// pointer to the offset where the cell content of the leaf begins
+uint32_t *leaf_node_content_start(void *node) {
+  return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+// pointer to the number of bytes held by cells no slot points at
+uint32_t *leaf_node_fragmented(void *node) {
+  return node + LEAF_NODE_FRAGMENTED_OFFSET;
+}
+
+// the keys of a node sit in one array right after its header, so a
+// search reads a few cache lines of keys and nothing else. the values
+// that go with them follow in an array of their own, the cell offsets of
+// a leaf or the children of an internal node. both arrays grow with the
+// number of keys, which moves the values whenever it changes. these
+// move the values and keys of a node that has num_keys keys now
+
+// the values array after the number of keys changed to new_num_keys,
+// the values of the keys that are left keep their place in it
+void node_resize_arrays(void *keys, uint32_t num_keys, uint32_t new_num_keys,
+                        uint32_t value_size) {
+  uint32_t kept = num_keys < new_num_keys ? num_keys : new_num_keys;
+  memmove(keys + new_num_keys * sizeof(uint32_t),
+          keys + num_keys * sizeof(uint32_t), kept * value_size);
+}
+
+// opens a gap for one more key and value at index
+void node_insert_slot(void *keys, uint32_t num_keys, uint32_t index,
+                      uint32_t value_size) {
+  void *values = keys + num_keys * sizeof(uint32_t);
+  void *new_values = values + sizeof(uint32_t);
+  memmove(new_values + (index + 1) * value_size, values + index * value_size,
+          (num_keys - index) * value_size);
+  memmove(new_values, values, index * value_size);
+  memmove(keys + (index + 1) * sizeof(uint32_t),
+          keys + index * sizeof(uint32_t),
+          (num_keys - index) * sizeof(uint32_t));
+}
+
+// closes the gap left by the key and value at index
+void node_remove_slot(void *keys, uint32_t num_keys, uint32_t index,
+                      uint32_t value_size) {
+  void *values = keys + num_keys * sizeof(uint32_t);
+  void *new_values = values - sizeof(uint32_t);
+  memmove(keys + index * sizeof(uint32_t),
+          keys + (index + 1) * sizeof(uint32_t),
+          (num_keys - index - 1) * sizeof(uint32_t));
+  memmove(new_values, values, index * value_size);
+  memmove(new_values + index * value_size, values + (index + 1) * value_size,
+          (num_keys - index - 1) * value_size);
+}
+
+// returns a pointer to the keys of a leaf
+uint32_t *leaf_node_keys(void *node) { return node + LEAF_NODE_HEADER_SIZE; }
+
+// returns a pointer to the slot holding the offset of a cell
+uint16_t *leaf_node_slot(void *node, uint32_t cell_num) {
+  return (void *)(leaf_node_keys(node) + *leaf_node_num_cells(node)) +
+         cell_num * LEAF_NODE_OFFSET_SIZE;
+}
+
 // returns a pointer to the particular cell
 void *leaf_node_cell(void *node, uint32_t cell_num) {
-  return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+  return node + *leaf_node_slot(node, cell_num);
 }
 
 // returns pointer to the key
 uint32_t *leaf_node_key(void *node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num);
+  return leaf_node_keys(node) + cell_num;
+}
+
+// changes the number of cells of a leaf, the cells that are left keep
+// their keys and slots
+void leaf_node_set_num_cells(void *node, uint32_t num_cells) {
+  node_resize_arrays(leaf_node_keys(node), *leaf_node_num_cells(node),
+                     num_cells, LEAF_NODE_OFFSET_SIZE);
+  *leaf_node_num_cells(node) = num_cells;
 }
 
-// return pointer to the value / location fo memory where row is serialised
+// return pointer to the value / location fo memory where row is serialised.
+// the value is all of the cell, the id of the row is its key
 void *leaf_node_value(void *node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+  return leaf_node_cell(node, cell_num);
+}
+
+// the size of a cell, read from the lengths stored inside it
+uint32_t leaf_node_cell_size(void *cell) {
+  uint8_t *username_length = cell;
+  uint8_t *email_length =
+      (void *)username_length + LEAF_NODE_LENGTH_SIZE + *username_length;
+  return 2 * LEAF_NODE_LENGTH_SIZE + *username_length + *email_length;
+}
+
+// the space a leaf has left for new cells and their slots, counting
+// fragmented space which compaction can reclaim
+uint32_t leaf_node_free_space(void *node) {
+  return *leaf_node_content_start(node) - LEAF_NODE_HEADER_SIZE -
+         *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE +
+         *leaf_node_fragmented(node);
 }
 
 // this method is used to setup type of node
@@ -174,449 +661,4242 @@ void set_node_type(void *node, NodeType type) {
   *((uint8_t *)(node + NODE_TYPE_OFFSET)) = value;
 }
 
-// TODO: add notes
+// marks if the node is the root of the tree
 void set_node_root(void *node, bool is_root) {
   uint8_t value = is_root;
   *((uint8_t *)(node + IS_ROOT_OFFSET)) = value;
 }
 
+// checks if the node is the root of the tree
+bool is_node_root(void *node) {
+  uint8_t value = *((uint8_t *)(node + IS_ROOT_OFFSET));
+  return (bool)value;
+}
+
 // this method is used to initialize a node
-void initialize_leaf_node(void *node) {
+void initialize_leaf_node(void *node, uint32_t page_size) {
   set_node_type(node, NODE_LEAF);
   set_node_root(node, false);
   *leaf_node_num_cells(node) = 0;
+  *leaf_node_next_leaf(node) = 0;
+  *leaf_node_content_start(node) = page_size;
+  *leaf_node_fragmented(node) = 0;
 }
 
-// TODO: add notes
+// pointer to the number of keys in an internal node
 uint32_t *internal_node_num_keys(void *node) {
   return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
 }
 
-// TODO: add notes
+// this method is used to initialize an internal node
 void initialize_internal_node(void *node) {
   set_node_type(node, NODE_INTERNAL);
   set_node_root(node, false);
   *internal_node_num_keys(node) = 0;
 }
 
-// utility to print row using select statement
-void print_row(Row *row) {
-  printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+// pointer to the child holding the keys larger than every key in the node
+uint32_t *internal_node_right_child(void *node) {
+  return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
 }
 
-// this method is used to get type of node
-// if it is a leaf or internal node
-NodeType get_node_type(void *node) {
-  uint8_t value = *((uint8_t *)(node + NODE_TYPE_OFFSET));
-  return (NodeType)value;
+// returns a pointer to the keys of an internal node, key i is the
+// largest key found in child i
+uint32_t *internal_node_keys(void *node) {
+  return node + INTERNAL_NODE_HEADER_SIZE;
 }
 
-// copies from source to pages
-void serialize_row(Row *source, void *destination) {
-  memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-  memcpy(destination + USERNAME_OFFSET, &(source->username), USERNAME_SIZE);
-  memcpy(destination + EMAIL_OFFSET, &(source->email), EMAIL_SIZE);
+// returns the child at the given index, the index one past the last
+// key refers to the right child
+uint32_t *internal_node_child(void *node, uint32_t child_num) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  if (child_num > num_keys) {
+    printf("Tried to access child_num %d > num_keys %d\n", child_num, num_keys);
+    exit(EXIT_FAILURE);
+  } else if (child_num == num_keys) {
+    return internal_node_right_child(node);
+  } else {
+    return internal_node_keys(node) + num_keys + child_num;
+  }
 }
 
-// copies from pages to destination
-void deserialize_row(void *source, Row *destination) {
-  memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-  memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-  memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+// returns the key of the child at the given index
+uint32_t *internal_node_key(void *node, uint32_t key_num) {
+  return internal_node_keys(node) + key_num;
 }
 
-// the logic to retrive contents from the pager.
-// it acts like a cache allocates if we have not found contents
-// for a particular page number otherwise returns contents for
-// the give cached page number
-void *get_page(Pager *pager, uint32_t page_num) {
-  // we check if the page number exceeds
-  // the maximum specified pages limit
-  if (page_num > TABLE_MAX_PAGES) {
-    printf("Tried to fetch page number out of bounds. %d > %d\n", page_num,
-           TABLE_MAX_PAGES);
-    exit(EXIT_FAILURE);
+// a key search returns how many of the sorted keys are smaller than key,
+// which is the index of the first key that is not. the vector kernels
+// narrow the keys down to a block of KEY_SEARCH_BLOCK with the same
+// branch free halving as the scalar one and then count the keys below
+// key in that block several at a time. the kernel is picked once the
+// features of the cpu are known, see key_search_init
+typedef uint32_t (*KeySearch)(uint32_t *keys, uint32_t num_keys,
+                              uint32_t key);
+
+#define KEY_SEARCH_BLOCK 32
+
+// halves the range [base, base + *num_keys] which holds the answer until
+// it is at most limit keys long and returns its start
+uint32_t key_search_narrow(uint32_t *keys, uint32_t *num_keys, uint32_t key,
+                           uint32_t limit) {
+  uint32_t base = 0;
+  uint32_t length = *num_keys;
+  while (length > limit) {
+    uint32_t half = length / 2;
+    base = keys[base + half] < key ? base + half : base;
+    length -= half;
   }
+  *num_keys = length;
+  return base;
+}
 
-  // check if we have the content in the pager cache
-  // this case is for missed cache
-  if (pager->pages[page_num] == NULL) {
-    void *page = malloc(PAGE_SIZE);
-    uint32_t num_pages = pager->file_length / PAGE_SIZE;
-
-    // We might save a partial page at the end of the file
-    if (pager->file_length % PAGE_SIZE) {
-      num_pages += 1;
-    }
-
-    if (page_num <= num_pages) {
-      // used to read a file. we use file descriptor to keep track of which file
-      // is opened in the OS additional docs:
-      // https://www.ibm.com/docs/zh-tw/zos/2.4.0?topic=functions-lseek-change-offset-file
-      // i think lseek is used to create a file, second param is used to specify
-      // size of the file and seek set is used to point to the start of the
-      // file.
-      lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-      // since we are now at the start of the file, we will try to read the
-      // first PAGE_SIZE bits to the page object
-      ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-      if (bytes_read == -1) {
-        printf("Error reading the file: %d\n", errno);
-        exit(EXIT_FAILURE);
+uint32_t key_search_scalar(uint32_t *keys, uint32_t num_keys, uint32_t key) {
+  uint32_t base = key_search_narrow(keys, &num_keys, key, 1);
+  return base + (num_keys == 1 && keys[base] < key);
+}
+
+#if defined(__x86_64__)
+// the vector compares are signed, flipping the top bit of both sides
+// orders unsigned keys the same way
+#define KEY_SEARCH_BIAS 0x80000000u
+
+uint32_t key_search_sse2(uint32_t *keys, uint32_t num_keys, uint32_t key) {
+  uint32_t base = key_search_narrow(keys, &num_keys, key, KEY_SEARCH_BLOCK);
+  __m128i bias = _mm_set1_epi32(KEY_SEARCH_BIAS);
+  __m128i target = _mm_set1_epi32(key ^ KEY_SEARCH_BIAS);
+  uint32_t count = 0;
+  uint32_t i = 0;
+  for (; i + 4 <= num_keys; i += 4) {
+    __m128i block = _mm_loadu_si128((__m128i *)(keys + base + i));
+    __m128i smaller = _mm_cmpgt_epi32(target, _mm_xor_si128(block, bias));
+    count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(smaller)));
+  }
+  for (; i < num_keys; i++) {
+    count += keys[base + i] < key;
+  }
+  return base + count;
+}
+
+__attribute__((target("avx2"))) uint32_t key_search_avx2(uint32_t *keys,
+                                                         uint32_t num_keys,
+                                                         uint32_t key) {
+  uint32_t base = key_search_narrow(keys, &num_keys, key, KEY_SEARCH_BLOCK);
+  __m256i bias = _mm256_set1_epi32(KEY_SEARCH_BIAS);
+  __m256i target = _mm256_set1_epi32(key ^ KEY_SEARCH_BIAS);
+  uint32_t count = 0;
+  uint32_t i = 0;
+  for (; i + 8 <= num_keys; i += 8) {
+    __m256i block = _mm256_loadu_si256((__m256i *)(keys + base + i));
+    __m256i smaller =
+        _mm256_cmpgt_epi32(target, _mm256_xor_si256(block, bias));
+    count +=
+        __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(smaller)));
+  }
+  for (; i < num_keys; i++) {
+    count += keys[base + i] < key;
+  }
+  return base + count;
+}
+#endif
+
+KeySearch key_search = key_search_scalar;
+
+// picks the widest key search the cpu supports. every x86-64 cpu has
+// sse2, other machines use the scalar search
+void key_search_init() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  key_search =
+      __builtin_cpu_supports("avx2") ? key_search_avx2 : key_search_sse2;
+#endif
+}
+
+// returns the index of the child which should contain the given key,
+// the first child whose key is not smaller than the one we look for.
+// there is one more child than there are keys, so when every key is
+// smaller the search ends on the right child
+uint32_t internal_node_find_child(void *node, uint32_t key) {
+  return key_search(internal_node_keys(node), *internal_node_num_keys(node),
+                    key);
+}
+
+// most bytes a single row takes in any output format, a csv row with
+// every character quoted included
+#define RESULT_ROW_MAX_SIZE 1024
+
+ResultSink *new_result_sink() {
+  ResultSink *sink = malloc(sizeof(ResultSink));
+  sink->fd = STDOUT_FILENO;
+  sink->format = OUTPUT_TEXT;
+  sink->buffer = malloc(RESULT_BUFFER_SIZE);
+  sink->length = 0;
+  return sink;
+}
+
+// writes out the buffered rows. whatever printf still holds for stdout
+// goes first so the rows show up after the prompt they belong to
+void sink_flush(ResultSink *sink) {
+  if (sink->fd == STDOUT_FILENO) {
+    fflush(stdout);
+  }
+  uint32_t written = 0;
+  while (written < sink->length) {
+    ssize_t bytes_written =
+        write(sink->fd, sink->buffer + written, sink->length - written);
+    if (bytes_written < 0) {
+      if (errno == EINTR) {
+        continue;
       }
+      printf("Error writing output: %d\n", errno);
+      exit(EXIT_FAILURE);
     }
+    written += bytes_written;
+  }
+  sink->length = 0;
+}
 
-    // we store the read bytes into the array of pages
-    pager->pages[page_num] = page;
-
-    // if we get page number higher than current page we
-    // increment the max number of pages for the pager
-    if (page_num >= pager->num_pages) {
-      pager->num_pages = page_num + 1;
+// points the sink at a file, or back at stdout when path is "stdout".
+// returns false if the file can not be opened, the sink is left alone
+bool sink_open(ResultSink *sink, char *path) {
+  int fd = STDOUT_FILENO;
+  if (strcmp(path, "stdout") != 0) {
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (fd < 0) {
+      return false;
     }
   }
+  sink_flush(sink);
+  if (sink->fd != STDOUT_FILENO) {
+    close(sink->fd);
+  }
+  sink->fd = fd;
+  return true;
+}
 
-  // we return the specific page
-  return pager->pages[page_num];
+void sink_close(ResultSink *sink) {
+  sink_open(sink, "stdout");
+  free(sink->buffer);
+  free(sink);
 }
 
-// returns the cursor to the location of where row is
-// or where it must be incase we dont find it
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key) {
-  void *node = get_page(table->pager, page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
+// writes the decimal digits of value, returns the end of them
+char *format_uint64(char *destination, uint64_t value) {
+  char digits[20];
+  uint32_t num_digits = 0;
+  do {
+    digits[num_digits++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  while (num_digits > 0) {
+    *destination++ = digits[--num_digits];
+  }
+  return destination;
+}
 
-  Cursor *cursor = malloc(sizeof(Cursor));
-  cursor->table = table;
-  cursor->page_num = page_num;
+char *format_string(char *destination, char *value) {
+  size_t length = strlen(value);
+  memcpy(destination, value, length);
+  return destination + length;
+}
 
-  uint32_t min_index = 0;
-  uint32_t one_past_max_index = num_cells;
+// a csv field with a comma, a quote or a line break in it is quoted and
+// its quotes doubled as in RFC 4180, the way load_read_row reads it back
+char *format_csv_field(char *destination, char *value) {
+  if (strpbrk(value, ",\"\r\n") == NULL) {
+    return format_string(destination, value);
+  }
+  *destination++ = '"';
+  for (; *value != '\0'; value++) {
+    if (*value == '"') {
+      *destination++ = '"';
+    }
+    *destination++ = *value;
+  }
+  *destination++ = '"';
+  return destination;
+}
+
+// appends a row to the sink in its format
+void sink_write_row(ResultSink *sink, Row *row) {
+  if (sink->length + RESULT_ROW_MAX_SIZE > RESULT_BUFFER_SIZE) {
+    sink_flush(sink);
+  }
+  char *start = sink->buffer + sink->length;
+  char *end = start;
+  switch (sink->format) {
+    case OUTPUT_TEXT:
+      *end++ = '(';
+      end = format_uint64(end, row->id);
+      *end++ = ',';
+      *end++ = ' ';
+      end = format_string(end, row->username);
+      *end++ = ',';
+      *end++ = ' ';
+      end = format_string(end, row->email);
+      *end++ = ')';
+      *end++ = '\n';
+      break;
+    case OUTPUT_CSV:
+      end = format_uint64(end, row->id);
+      *end++ = ',';
+      end = format_csv_field(end, row->username);
+      *end++ = ',';
+      end = format_csv_field(end, row->email);
+      *end++ = '\n';
+      break;
+    case OUTPUT_BINARY:
+      // the strings of a record are zero padded
+      memset(start, 0, ROW_SIZE);
+      memcpy(start + ID_OFFSET, &row->id, ID_SIZE);
+      memcpy(start + USERNAME_OFFSET, row->username, strlen(row->username));
+      memcpy(start + EMAIL_OFFSET, row->email, strlen(row->email));
+      end = start + ROW_SIZE;
+      break;
+  }
+  sink->length += end - start;
+}
 
-  while (min_index != one_past_max_index) {
-    uint32_t index = (min_index + one_past_max_index) / 2;
-    uint32_t key_at_index = *leaf_node_key(node, index);
-    if (key == key_at_index) {
-      cursor->cell_num = index;
-      return cursor;
+// appends the tuple an aggregate select computed to the sink, its values
+// in the order they were asked for. min and max of no rows at all are
+// NULL in text and an empty field in csv. there is no binary record for
+// a tuple, binary output gets the csv line
+void sink_write_aggregates(ResultSink *sink, Aggregate *aggregates,
+                           uint32_t num_aggregates, uint64_t count,
+                           uint32_t min_id, uint32_t max_id, bool found) {
+  if (sink->length + RESULT_ROW_MAX_SIZE > RESULT_BUFFER_SIZE) {
+    sink_flush(sink);
+  }
+  bool text = sink->format == OUTPUT_TEXT;
+  char *start = sink->buffer + sink->length;
+  char *end = start;
+  if (text) {
+    *end++ = '(';
+  }
+  for (uint32_t i = 0; i < num_aggregates; i++) {
+    if (i > 0) {
+      *end++ = ',';
+      if (text) {
+        *end++ = ' ';
+      }
     }
-    if (key < key_at_index) {
-      one_past_max_index = index;
+    if (aggregates[i] == AGGREGATE_COUNT) {
+      end = format_uint64(end, count);
+    } else if (!found) {
+      end = format_string(end, text ? "NULL" : "");
+    } else if (aggregates[i] == AGGREGATE_MIN_ID) {
+      end = format_uint64(end, min_id);
     } else {
-      min_index = index + 1;
+      end = format_uint64(end, max_id);
     }
   }
+  if (text) {
+    *end++ = ')';
+  }
+  *end++ = '\n';
+  sink->length += end - start;
+}
 
-  cursor->cell_num = min_index;
-  return cursor;
+// this method is used to get type of node
+// if it is a leaf or internal node
+NodeType get_node_type(void *node) {
+  uint8_t value = *((uint8_t *)(node + NODE_TYPE_OFFSET));
+  return (NodeType)value;
 }
 
-// this method is used to initialize a cursor
-// at the 0th row of the table
-Cursor *table_start(Table *table) {
-  Cursor *cursor = malloc(sizeof(Cursor));
+// the number of bytes a row takes in the cell of a leaf, its id is the
+// key of the cell and stored with the other keys
+uint32_t row_value_size(Row *row) {
+  return 2 * LEAF_NODE_LENGTH_SIZE + strlen(row->username) +
+         strlen(row->email);
+}
 
-  cursor->table = table;
-  // cursor->row_num = 0;
-  // cursor->end_of_table = (table->num_rows == 0);
-  cursor->page_num = table->root_page_num;
-  cursor->cell_num = 0;
+// the number of bytes a serialized row takes, its id and its value
+uint32_t serialized_row_size(Row *row) {
+  return ID_SIZE + row_value_size(row);
+}
 
-  void *root_node = get_page(table->pager, table->root_page_num);
-  uint32_t num_cells = *leaf_node_num_cells(root_node);
-  cursor->end_of_table = (num_cells == 0);
+// copies from source to pages, the strings are stored with a length
+// byte in front and without their padding
+void serialize_row_value(Row *source, void *destination) {
+  uint8_t username_length = strlen(source->username);
+  uint8_t email_length = strlen(source->email);
+  *(uint8_t *)destination = username_length;
+  memcpy(destination + LEAF_NODE_LENGTH_SIZE, source->username,
+         username_length);
+  destination += LEAF_NODE_LENGTH_SIZE + username_length;
+  *(uint8_t *)destination = email_length;
+  memcpy(destination + LEAF_NODE_LENGTH_SIZE, source->email, email_length);
+}
 
-  return cursor;
+// copies from pages to destination, everything but the id
+void deserialize_row_value(void *source, Row *destination) {
+  uint8_t username_length = *(uint8_t *)source;
+  memcpy(destination->username, source + LEAF_NODE_LENGTH_SIZE,
+         username_length);
+  destination->username[username_length] = '\0';
+  source += LEAF_NODE_LENGTH_SIZE + username_length;
+  uint8_t email_length = *(uint8_t *)source;
+  memcpy(destination->email, source + LEAF_NODE_LENGTH_SIZE, email_length);
+  destination->email[email_length] = '\0';
 }
 
-// returns the position for a given key
-// if no key, it gives us the position where it should be inserted
-Cursor *table_find(Table *table, uint32_t key) {
-  uint32_t root_page_num = table->root_page_num;
-  void *root_node = get_page(table->pager, root_page_num);
+// a serialized row is the id followed by the value, the way rows travel
+// outside of the leaves
+void serialize_row(Row *source, void *destination) {
+  memcpy(destination, &(source->id), ID_SIZE);
+  serialize_row_value(source, destination + ID_SIZE);
+}
 
-  if (get_node_type(root_node) == NODE_LEAF) {
-    return leaf_node_find(table, root_page_num, key);
-  } else {
-    printf("Need to implement searching an internal node\n");
-    exit(EXIT_FAILURE);
-  }
+void deserialize_row(void *source, Row *destination) {
+  memcpy(&(destination->id), source, ID_SIZE);
+  deserialize_row_value(source + ID_SIZE, destination);
+}
+
+// copies the row of a cell out of a leaf
+void leaf_node_read_row(void *node, uint32_t cell_num, Row *row) {
+  row->id = *leaf_node_key(node, cell_num);
+  deserialize_row_value(leaf_node_value(node, cell_num), row);
 }
 
-// this method is used to see row fits in which page of the table
-void *cursor_value(Cursor *cursor) {
-  // for a particular page number
-  // we retrive the page from the pager cache
-  uint32_t page_num = cursor->page_num;
-  void *page = get_page(cursor->table->pager, page_num);
+// the value a row holds in one of its string columns
+char *row_column(Row *row, StringColumn column) {
+  return column == COLUMN_USERNAME ? row->username : row->email;
+}
 
-  return leaf_node_value(page, cursor->cell_num);
+// copies a row to its fixed size record in a binary load file
+void serialize_row_record(Row *source, void *destination) {
+  memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
+  memcpy(destination + USERNAME_OFFSET, &(source->username), USERNAME_SIZE);
+  memcpy(destination + EMAIL_OFFSET, &(source->email), EMAIL_SIZE);
 }
 
-// incrementing the cursor to the next row / cell
-void cursor_advance(Cursor *cursor) {
-  uint32_t page_num = cursor->page_num;
-  void *node = get_page(cursor->table->pager, page_num);
+// copies a fixed size record of a binary load file to a row
+void deserialize_row_record(void *source, Row *destination) {
+  memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
+  memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
+  memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+}
 
-  cursor->cell_num += 1;
-  if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-    cursor->end_of_table = true;
+// FNV-1a checksum over a log frame so torn or stale frames at the end
+// of the log are detected during recovery
+uint32_t wal_checksum(uint32_t page_num, uint32_t commit, void *page,
+                      uint32_t page_size) {
+  uint32_t hash = 2166136261u;
+  uint32_t header[2] = {page_num, commit};
+  uint8_t *bytes = (uint8_t *)header;
+  for (uint32_t i = 0; i < sizeof(header); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
   }
+  bytes = page;
+  for (uint32_t i = 0; i < page_size; i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
 }
 
-// this method reads from the database file where existing writes have occured
-Pager *pager_open(const char *filename) {
-  // we read the file with specific permissions
-  // we get the file descriptor for the read file
-  int fd = open(filename,
-                O_RDWR |       // read / write mode
-                    O_CREAT,   // make new file if it does not exists
-                S_IWUSR |      // write permission
-                    S_IRUSR);  // read permission
+// opens (or creates) the log file which lives next to the database file
+Wal *wal_open(const char *db_filename, uint32_t group_commit,
+              uint32_t page_size, LatencyHistogram *sync_latency) {
+  Wal *wal = malloc(sizeof(Wal));
+  wal->path = malloc(strlen(db_filename) + 5);
+  sprintf(wal->path, "%s-wal", db_filename);
 
-  // file descriptor is -1 if opening of file has failed for some reason
-  if (fd == -1) {
-    printf("Unable to open file.\n");
+  wal->file_descriptor = open(wal->path, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+  if (wal->file_descriptor == -1) {
+    printf("Unable to open log file.\n");
     exit(EXIT_FAILURE);
   }
 
-  // we get the length of the file where database entries have been made
-  off_t file_length = lseek(fd, 0, SEEK_END);
-
-  // we allocate a new pager and setup the coressponding file
-  // descriptor and length of the pager abstraction / file length
-  Pager *pager = malloc(sizeof(Pager));
-  pager->file_descriptor = fd;
-  pager->file_length = file_length;
-  pager->num_pages = (file_length / PAGE_SIZE);
+  wal->num_frames = 0;
+  wal->unsynced_commits = 0;
+  wal->group_commit = group_commit;
+  wal->page_size = page_size;
+  wal->buffer = NULL;
+  wal->buffer_capacity = 0;
+  wal->buffer_length = 0;
+  wal->sync_latency = sync_latency;
+  return wal;
+}
 
-  // is intended as a check to see if length of file is
-  // divisible by PAGE_SIZE and check if the file is corrupted or not
-  if (file_length % PAGE_SIZE != 0) {
-    printf("Db file is not a whole number of pages. Corrupt file.\n");
+// makes every commit appended so far durable with a single fsync
+void wal_sync(Wal *wal) {
+  if (wal->unsynced_commits == 0) {
+    return;
+  }
+  uint64_t start = stats_now();
+  if (fdatasync(wal->file_descriptor) == -1) {
+    printf("Error syncing log: %d\n", errno);
     exit(EXIT_FAILURE);
   }
+  latency_record(wal->sync_latency, start);
+  wal->unsynced_commits = 0;
+}
 
-  // we initialize the pages in a pager to be null
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    pager->pages[i] = NULL;
+// empties the log once all of its pages are safely in the database file
+void wal_reset(Wal *wal) {
+  if (ftruncate(wal->file_descriptor, 0) == -1 ||
+      fsync(wal->file_descriptor) == -1) {
+    printf("Error truncating log: %d\n", errno);
+    exit(EXIT_FAILURE);
   }
-
-  return pager;
+  wal->num_frames = 0;
+  wal->unsynced_commits = 0;
 }
 
-// this method is used to flush the contents of the page to the database file
-void pager_flush(Pager *pager, uint32_t page_num) {
-  // before flushing contents we check if the current page is null
-  if (pager->pages[page_num] == NULL) {
-    printf("Tried to flush null page\n");
-    exit(EXIT_FAILURE);
+// copies a page image into the staging buffer of the current commit
+void wal_stage_frame(Wal *wal, uint32_t page_num, void *page, bool commit) {
+  if (wal->buffer_length + WAL_FRAME_SIZE(wal) > wal->buffer_capacity) {
+    wal->buffer_capacity = 2 * wal->buffer_capacity + WAL_FRAME_SIZE(wal);
+    wal->buffer = realloc(wal->buffer, wal->buffer_capacity);
   }
 
-  off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
+  uint32_t *header = wal->buffer + wal->buffer_length;
+  header[0] = page_num;
+  header[1] = commit;
+  header[2] = wal_checksum(page_num, commit, page, wal->page_size);
+  memcpy(wal->buffer + wal->buffer_length + WAL_FRAME_HEADER_SIZE, page,
+         wal->page_size);
+  wal->buffer_length += WAL_FRAME_SIZE(wal);
+}
 
-  if (offset == -1) {
-    printf("Error seeking: %d\n", errno);
-    exit(EXIT_FAILURE);
+// appends the staged frames of a statement with one sequential write.
+// the fsync is only issued once group_commit statements have committed,
+// so many statements share the cost of a single flush to the device
+void wal_commit(Wal *wal) {
+  if (wal->buffer_length == 0) {
+    return;
   }
 
-  // we write the contents of the current page to the
-  // file represented by file descriptor
+  off_t offset = (off_t)wal->num_frames * WAL_FRAME_SIZE(wal);
   ssize_t bytes_written =
-      write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
-
-  if (bytes_written == -1) {
-    printf("Error writing: %d\n", errno);
+      pwrite(wal->file_descriptor, wal->buffer, wal->buffer_length, offset);
+  if (bytes_written != wal->buffer_length) {
+    printf("Error writing log: %d\n", errno);
     exit(EXIT_FAILURE);
   }
-}
-
-// this method is used to perform processes before the program exits safely
-void db_close(Table *table) {
-  Pager *pager = table->pager;
-  // we check how many pages are completely full and then flush these to the
-  // disk after flushing the contents to the disk we free up the page memory
 
-  for (uint32_t i = 0; i < pager->num_pages; i++) {
-    if (pager->pages[i] == NULL) {
-      continue;
-    }
-    pager_flush(pager, i);
-    free(pager->pages[i]);
-    pager->pages[i] = NULL;
+  wal->num_frames += wal->buffer_length / WAL_FRAME_SIZE(wal);
+  wal->buffer_length = 0;
+  wal->unsynced_commits += 1;
+  if (wal->unsynced_commits >= wal->group_commit) {
+    wal_sync(wal);
   }
+}
 
-  // after writing is complete we close the file represented
-  // by file descriptor to indicate to the OS that the file has been closed
-  int result = close(pager->file_descriptor);
-  if (result == -1) {
-    printf("Error closing db file.\n");
-    exit(EXIT_FAILURE);
+// a small LZ77 codec in the spirit of LZ4 for compressed database files.
+// the output is a list of sequences, each a token byte with the number
+// of literals in the high and the match length minus LZ_MIN_MATCH in the
+// low four bits, the literals, a two byte backwards offset and the match.
+// counts of 15 or more go on in extra bytes, 255 meaning another byte
+// follows. the last sequence only has literals
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+
+// appends one sequence, returns false if it does not fit in capacity.
+// a match of 0 marks the last sequence
+bool lz_put_sequence(uint8_t *destination, uint32_t *out, uint32_t capacity,
+                     const uint8_t *literals, uint32_t num_literals,
+                     uint32_t offset, uint32_t match) {
+  uint32_t worst_case = 1 + num_literals / 255 + 1 + num_literals + 2 +
+                        match / 255 + 1;
+  if (*out + worst_case > capacity) {
+    return false;
   }
 
-  // after flushing contents to the disk we free up all the pages
-  // the pager abstraction and the table object
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    void *page = pager->pages[i];
-    if (page) {
-      free(page);
-      pager->pages[i] = NULL;
+  uint32_t literal_code = num_literals < 15 ? num_literals : 15;
+  uint32_t match_code = 0;
+  if (match > 0) {
+    match_code = match - LZ_MIN_MATCH < 15 ? match - LZ_MIN_MATCH : 15;
+  }
+  destination[(*out)++] = (literal_code << 4) | match_code;
+  if (literal_code == 15) {
+    uint32_t rest = num_literals - 15;
+    for (; rest >= 255; rest -= 255) {
+      destination[(*out)++] = 255;
     }
+    destination[(*out)++] = rest;
   }
-
-  free(pager);
-  free(table);
+  memcpy(destination + *out, literals, num_literals);
+  *out += num_literals;
+
+  if (match > 0) {
+    destination[(*out)++] = offset & 0xff;
+    destination[(*out)++] = offset >> 8;
+    if (match_code == 15) {
+      uint32_t rest = match - LZ_MIN_MATCH - 15;
+      for (; rest >= 255; rest -= 255) {
+        destination[(*out)++] = 255;
+      }
+      destination[(*out)++] = rest;
+    }
+  }
+  return true;
+}
+
+// compresses length bytes of source, returns the compressed length or 0
+// if the result would not fit in capacity. matches are found through a
+// hash table of the last position every four byte sequence was seen at
+uint32_t lz_compress(const uint8_t *source, uint32_t length,
+                     uint8_t *destination, uint32_t capacity) {
+  uint32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0xff, sizeof(table));
+  uint32_t anchor = 0;
+  uint32_t position = 0;
+  uint32_t out = 0;
+
+  while (position + LZ_MIN_MATCH <= length) {
+    uint32_t word;
+    memcpy(&word, source + position, sizeof(word));
+    uint32_t hash = (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+    uint32_t candidate = table[hash];
+    table[hash] = position;
+    if (candidate == UINT32_MAX || position - candidate > 0xffff ||
+        memcmp(source + candidate, source + position, LZ_MIN_MATCH) != 0) {
+      position += 1;
+      continue;
+    }
+
+    uint32_t match = LZ_MIN_MATCH;
+    while (position + match < length &&
+           source[candidate + match] == source[position + match]) {
+      match += 1;
+    }
+    if (!lz_put_sequence(destination, &out, capacity, source + anchor,
+                         position - anchor, position - candidate, match)) {
+      return 0;
+    }
+    position += match;
+    anchor = position;
+  }
+
+  if (!lz_put_sequence(destination, &out, capacity, source + anchor,
+                       length - anchor, 0, 0)) {
+    return 0;
+  }
+  return out;
+}
+
+// reads a count that went on past its four bits in the token
+bool lz_get_length(const uint8_t *source, uint32_t length, uint32_t *in,
+                   uint32_t *count) {
+  uint8_t byte;
+  do {
+    if (*in >= length) {
+      return false;
+    }
+    byte = source[(*in)++];
+    *count += byte;
+  } while (byte == 255);
+  return true;
+}
+
+// decompresses into exactly size bytes, returns false for input which
+// is damaged or does not decompress to that size
+bool lz_decompress(const uint8_t *source, uint32_t length,
+                   uint8_t *destination, uint32_t size) {
+  uint32_t in = 0;
+  uint32_t out = 0;
+
+  while (in < length) {
+    uint8_t token = source[in++];
+    uint32_t num_literals = token >> 4;
+    if (num_literals == 15 &&
+        !lz_get_length(source, length, &in, &num_literals)) {
+      return false;
+    }
+    if (in + num_literals > length || out + num_literals > size) {
+      return false;
+    }
+    memcpy(destination + out, source + in, num_literals);
+    in += num_literals;
+    out += num_literals;
+    if (in == length) {
+      break;
+    }
+
+    if (in + 2 > length) {
+      return false;
+    }
+    uint32_t offset = source[in] | (source[in + 1] << 8);
+    in += 2;
+    uint32_t match = (token & 15) + LZ_MIN_MATCH;
+    if ((token & 15) == 15 && !lz_get_length(source, length, &in, &match)) {
+      return false;
+    }
+    if (offset == 0 || offset > out || out + match > size) {
+      return false;
+    }
+    // the match may overlap the bytes it produces, so copy byte by byte
+    for (uint32_t i = 0; i < match; i++) {
+      destination[out + i] = destination[out - offset + i];
+    }
+    out += match;
+  }
+
+  return out == size;
+}
+
+// the space an extent of the given length takes in the file
+uint32_t extent_capacity(uint32_t length) {
+  return (length + COMPRESSED_GRANULE - 1) / COMPRESSED_GRANULE *
+         COMPRESSED_GRANULE;
+}
+
+// returns space to the free extents, merging it with its neighbours
+void page_map_release(PageMap *map, uint64_t offset, uint32_t length) {
+  uint32_t index = 0;
+  while (index < map->num_free && map->free[index].offset < offset) {
+    index += 1;
+  }
+  Extent *previous = index > 0 ? &map->free[index - 1] : NULL;
+  Extent *next = index < map->num_free ? &map->free[index] : NULL;
+
+  if (previous != NULL && previous->offset + previous->length == offset) {
+    previous->length += length;
+    if (next != NULL && offset + length == next->offset) {
+      previous->length += next->length;
+      memmove(next, next + 1,
+              (map->num_free - index - 1) * sizeof(Extent));
+      map->num_free -= 1;
+    }
+    return;
+  }
+  if (next != NULL && offset + length == next->offset) {
+    next->offset = offset;
+    next->length += length;
+    return;
+  }
+
+  map->free = realloc(map->free, sizeof(Extent) * (map->num_free + 1));
+  memmove(&map->free[index + 1], &map->free[index],
+          (map->num_free - index) * sizeof(Extent));
+  map->free[index] = (Extent){offset, length};
+  map->num_free += 1;
+}
+
+// finds room for length bytes, the first free extent large enough is
+// used, otherwise the space is taken from the end of the file
+uint64_t page_map_allocate(PageMap *map, uint32_t length) {
+  for (uint32_t i = 0; i < map->num_free; i++) {
+    if (map->free[i].length >= length) {
+      uint64_t offset = map->free[i].offset;
+      map->free[i].offset += length;
+      map->free[i].length -= length;
+      if (map->free[i].length == 0) {
+        memmove(&map->free[i], &map->free[i + 1],
+                (map->num_free - i - 1) * sizeof(Extent));
+        map->num_free -= 1;
+      }
+      return offset;
+    }
+  }
+  uint64_t offset = map->file_end;
+  map->file_end += length;
+  return offset;
+}
+
+// orders extents by offset for qsort
+int compare_extents(const void *a, const void *b) {
+  uint64_t offset_a = ((const Extent *)a)->offset;
+  uint64_t offset_b = ((const Extent *)b)->offset;
+  return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+// writes the map of a compressed file to a new extent and then points
+// the header at it. the header is only written once the pages and the
+// map are durable, so a crash in between leaves the old map in charge.
+// pages may have moved into space the old map still points at, but
+// every page written since the last sync is in the log and replaying
+// it puts the page back where the old map expects it
+void page_map_sync(PageMap *map, int file_descriptor) {
+  uint32_t map_length = map->num_pages * sizeof(Extent);
+  Extent old_map = map->map;
+  map->map.length = map_length;
+  map->map.offset = page_map_allocate(map, extent_capacity(map_length));
+  if (pwrite(file_descriptor, map->pages, map_length, map->map.offset) !=
+          map_length ||
+      fsync(file_descriptor) == -1) {
+    printf("Error writing page map: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+
+  CompressedHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, COMPRESSED_MAGIC, sizeof(header.magic));
+  header.page_size = map->page_size;
+  header.num_pages = map->num_pages;
+  header.map_length = map_length;
+  header.map_offset = map->map.offset;
+  if (pwrite(file_descriptor, &header, sizeof(header), 0) != sizeof(header) ||
+      fsync(file_descriptor) == -1) {
+    printf("Error writing db header: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+
+  if (old_map.length > 0) {
+    page_map_release(map, old_map.offset, extent_capacity(old_map.length));
+  }
+}
+
+// reads the header and the map of a compressed file, or returns NULL if
+// the file is not compressed. an empty file becomes a compressed file
+// with pages of page_size bytes when create is set. the free extents are
+// the gaps between the extents the map uses
+PageMap *page_map_open(int file_descriptor, bool create, uint32_t page_size) {
+  CompressedHeader header;
+  ssize_t bytes_read = pread(file_descriptor, &header, sizeof(header), 0);
+  bool empty = lseek(file_descriptor, 0, SEEK_END) == 0;
+  if (!empty && (bytes_read != sizeof(header) ||
+                 memcmp(header.magic, COMPRESSED_MAGIC,
+                        sizeof(header.magic)) != 0)) {
+    return NULL;
+  }
+  if (empty && !create) {
+    return NULL;
+  }
+
+  PageMap *map = calloc(1, sizeof(PageMap));
+  map->page_size = empty ? page_size : header.page_size;
+  map->buffer = malloc(map->page_size);
+  map->file_end = COMPRESSED_HEADER_SIZE;
+  if (empty) {
+    page_map_sync(map, file_descriptor);
+    return map;
+  }
+
+  map->num_pages = header.num_pages;
+  map->capacity = header.num_pages;
+  map->pages = calloc(map->capacity + 1, sizeof(Extent));
+  map->map.offset = header.map_offset;
+  map->map.length = header.map_length;
+  if (pread(file_descriptor, map->pages, header.map_length,
+            header.map_offset) != header.map_length) {
+    printf("Error reading page map: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t num_used = 0;
+  Extent *used = malloc(sizeof(Extent) * (map->num_pages + 1));
+  used[num_used++] =
+      (Extent){map->map.offset, extent_capacity(map->map.length)};
+  for (uint32_t i = 0; i < map->num_pages; i++) {
+    if (map->pages[i].length > 0) {
+      used[num_used++] = (Extent){map->pages[i].offset,
+                                  extent_capacity(map->pages[i].length)};
+    }
+  }
+  qsort(used, num_used, sizeof(Extent), compare_extents);
+  for (uint32_t i = 0; i < num_used; i++) {
+    if (used[i].offset > map->file_end) {
+      page_map_release(map, map->file_end, used[i].offset - map->file_end);
+    }
+    if (used[i].offset + used[i].length > map->file_end) {
+      map->file_end = used[i].offset + used[i].length;
+    }
+  }
+  free(used);
+  return map;
+}
+
+// reads a page of a compressed file into the buffer, pages which were
+// never written read as zeros. returns how many bytes were read
+uint32_t page_map_read(PageMap *map, int file_descriptor, uint32_t page_num,
+                       void *page) {
+  if (page_num >= map->num_pages || map->pages[page_num].length == 0) {
+    memset(page, 0, map->page_size);
+    return 0;
+  }
+
+  Extent *extent = &map->pages[page_num];
+  if (pread(file_descriptor, map->buffer, extent->length, extent->offset) !=
+      extent->length) {
+    printf("Error reading the file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  // a page which did not compress is stored as it is
+  if (extent->length == map->page_size) {
+    memcpy(page, map->buffer, map->page_size);
+  } else if (!lz_decompress(map->buffer, extent->length, page,
+                            map->page_size)) {
+    printf("Page %d of the db file is corrupt.\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+  return extent->length;
+}
+
+// compresses a page and writes it to its extent, or to a new one if it
+// outgrew the old extent. returns how many bytes were written
+uint32_t page_map_write(PageMap *map, int file_descriptor, uint32_t page_num,
+                        void *page) {
+  uint32_t length =
+      lz_compress(page, map->page_size, map->buffer, map->page_size - 1);
+  void *data = map->buffer;
+  if (length == 0) {
+    length = map->page_size;
+    data = page;
+  }
+
+  if (page_num >= map->capacity) {
+    uint32_t new_capacity = 2 * map->capacity + 16;
+    while (new_capacity <= page_num) {
+      new_capacity *= 2;
+    }
+    map->pages = realloc(map->pages, sizeof(Extent) * new_capacity);
+    memset(&map->pages[map->capacity], 0,
+           sizeof(Extent) * (new_capacity - map->capacity));
+    map->capacity = new_capacity;
+  }
+  if (page_num >= map->num_pages) {
+    map->num_pages = page_num + 1;
+  }
+
+  Extent *extent = &map->pages[page_num];
+  uint32_t capacity = extent_capacity(length);
+  if (extent->length == 0 || extent_capacity(extent->length) < capacity) {
+    if (extent->length > 0) {
+      page_map_release(map, extent->offset, extent_capacity(extent->length));
+    }
+    extent->offset = page_map_allocate(map, capacity);
+  }
+  extent->length = length;
+
+  if (pwrite(file_descriptor, data, length, extent->offset) != length) {
+    printf("Error writing: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  return length;
+}
+
+// reads a page from the database file into the buffer, pages past the
+// end of the file read as zeros. a compressed file is read through the
+// buffer of its page map, so the pager lock has to be held for it
+void pager_read_page(Pager *pager, uint32_t page_num, void *page) {
+  stats_add(&pager->stats.pages_read, 1);
+  if (pager->page_map != NULL) {
+    uint32_t length = page_map_read(pager->page_map, pager->file_descriptor,
+                                    page_num, page);
+    stats_add(&pager->stats.bytes_read, length);
+    return;
+  }
+
+  // pread leaves the file offset alone, so several threads can read at
+  // once. nothing is read past the end of the file and the rest of the
+  // page stays zero, which also covers a partial page at the end
+  ssize_t bytes_read = pread(pager->file_descriptor, page, pager->page_size,
+                             (off_t)page_num * pager->page_size);
+  if (bytes_read == -1) {
+    printf("Error reading the file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  stats_add(&pager->stats.bytes_read, bytes_read);
+  memset(page + bytes_read, 0, pager->page_size - bytes_read);
+}
+
+// writes a page to its place in the database file
+void pager_write_page(Pager *pager, uint32_t page_num, void *page) {
+  stats_add(&pager->stats.pages_written, 1);
+  if (pager->page_map != NULL) {
+    uint32_t length = page_map_write(pager->page_map, pager->file_descriptor,
+                                     page_num, page);
+    stats_add(&pager->stats.bytes_written, length);
+    return;
+  }
+
+  // we write the contents of the current page to its offset in the
+  // file represented by file descriptor
+  ssize_t bytes_written = pwrite(pager->file_descriptor, page, pager->page_size,
+                                 (off_t)page_num * pager->page_size);
+
+  if (bytes_written == -1) {
+    printf("Error writing: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  stats_add(&pager->stats.bytes_written, bytes_written);
+
+  // the file grows when a page past its end gets written out, so pages
+  // evicted before the first flush can be read back later
+  uint32_t end_of_page = (page_num + 1) * pager->page_size;
+  if (end_of_page > pager->file_length) {
+    pager->file_length = end_of_page;
+  }
+}
+
+// makes the pages written so far durable, a compressed file also gets
+// a new map pointing at them
+void pager_sync(Pager *pager) {
+  uint64_t start = stats_now();
+  if (pager->page_map != NULL) {
+    pthread_mutex_lock(&pager->lock);
+    page_map_sync(pager->page_map, pager->file_descriptor);
+    pthread_mutex_unlock(&pager->lock);
+  } else if (fdatasync(pager->file_descriptor) == -1) {
+    // the size of the file is synced along with the data, none of the
+    // other metadata fsync would flush matters to us
+    printf("Error syncing db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  latency_record(&pager->stats.sync, start);
+}
+
+// redo recovery, replays every complete commit found in the log into the
+// database file through the pager. frames after the last valid commit
+// marker belong to a statement which never committed and are thrown away
+void wal_recover(Wal *wal, Pager *pager) {
+  void *page = malloc(wal->page_size);
+  uint32_t header[3];
+  uint32_t group_start = 0;
+  uint32_t frame_num = 0;
+  bool replayed = false;
+
+  while (true) {
+    off_t offset = (off_t)frame_num * WAL_FRAME_SIZE(wal);
+    if (pread(wal->file_descriptor, header, WAL_FRAME_HEADER_SIZE, offset) !=
+            WAL_FRAME_HEADER_SIZE ||
+        pread(wal->file_descriptor, page, wal->page_size,
+              offset + WAL_FRAME_HEADER_SIZE) != wal->page_size ||
+        header[2] !=
+            wal_checksum(header[0], header[1], page, wal->page_size)) {
+      break;
+    }
+    frame_num += 1;
+    if (!header[1]) {
+      continue;
+    }
+
+    // a commit marker, so every frame of the group can be applied
+    for (uint32_t i = group_start; i < frame_num; i++) {
+      offset = (off_t)i * WAL_FRAME_SIZE(wal);
+      pread(wal->file_descriptor, header, WAL_FRAME_HEADER_SIZE, offset);
+      pread(wal->file_descriptor, page, wal->page_size,
+            offset + WAL_FRAME_HEADER_SIZE);
+      pager_write_page(pager, header[0], page);
+    }
+    group_start = frame_num;
+    replayed = true;
+  }
+
+  if (replayed) {
+    pager_sync(pager);
+  }
+  wal_reset(wal);
+  free(page);
+}
+
+// latches prefer writers, otherwise a steady stream of readers passing
+// the root could keep a writer waiting for good. that kind of latch may
+// not be taken twice by one thread, which the tree never does
+void latch_init(pthread_rwlock_t *latch) {
+  pthread_rwlockattr_t attributes;
+  pthread_rwlockattr_init(&attributes);
+  pthread_rwlockattr_setkind_np(&attributes,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(latch, &attributes);
+  pthread_rwlockattr_destroy(&attributes);
+}
+
+// maps a page number to its bucket in the buffer pool hash table
+uint32_t pager_bucket(Pager *pager, uint32_t page_num) {
+  return (page_num * 2654435761u) & (pager->num_buckets - 1);
+}
+
+// returns the frame holding the page or INVALID_FRAME if it is not cached
+uint32_t pager_lookup(Pager *pager, uint32_t page_num) {
+  uint32_t frame_num = pager->buckets[pager_bucket(pager, page_num)];
+  while (frame_num != INVALID_FRAME) {
+    if (pager->frames[frame_num].page_num == page_num) {
+      return frame_num;
+    }
+    frame_num = pager->frames[frame_num].hash_next;
+  }
+  return INVALID_FRAME;
+}
+
+// unlinks a frame from the hash chain of the page it currently holds
+void pager_unlink_frame(Pager *pager, uint32_t frame_num) {
+  uint32_t page_num = pager->frames[frame_num].page_num;
+  uint32_t *link = &pager->buckets[pager_bucket(pager, page_num)];
+  while (*link != frame_num) {
+    link = &pager->frames[*link].hash_next;
+  }
+  *link = pager->frames[frame_num].hash_next;
+}
+
+// writes the contents of a dirty frame back to its place in the database
+// file, afterwards the frame matches the disk and is clean again
+void pager_write_frame(Pager *pager, uint32_t frame_num) {
+  Frame *frame = &pager->frames[frame_num];
+
+  // the log must be durable before a page it describes is overwritten,
+  // otherwise a crash could leave pages of an unsynced commit on disk
+  if (pager->wal != NULL) {
+    wal_sync(pager->wal);
+  }
+
+  pager_write_page(pager, frame->page_num, frame->data);
+
+  frame->dirty = false;
+  pager->num_dirty -= 1;
+}
+
+// picks a frame for a new page using the CLOCK algorithm.
+// free frames are used first, otherwise the hand sweeps the pool giving
+// every referenced frame a second chance until it finds an unpinned
+// frame that was not used since the last sweep. a dirty victim is
+// written back to the disk before the frame is handed out. returns
+// INVALID_FRAME when every frame is pinned
+uint32_t pager_try_evict(Pager *pager) {
+  for (uint32_t step = 0; step < 2 * pager->num_frames + 1; step++) {
+    uint32_t frame_num = pager->clock_hand;
+    Frame *frame = &pager->frames[frame_num];
+    pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+
+    if (!frame->in_use) {
+      return frame_num;
+    }
+    // pages changed by the running statement are not in the log yet,
+    // so they stay in memory until the statement commits
+    if (frame->pin_count > 0 || frame->in_txn || frame->loading) {
+      continue;
+    }
+    if (frame->referenced) {
+      frame->referenced = false;
+      continue;
+    }
+
+    if (frame->dirty) {
+      pager_write_frame(pager, frame_num);
+    }
+    pager_unlink_frame(pager, frame_num);
+    frame->in_use = false;
+    return frame_num;
+  }
+  return INVALID_FRAME;
+}
+
+// picks a frame for a page that has to be read now. a frame another
+// thread is reading into can be taken once the read is done, so those
+// reads are waited for before giving up
+uint32_t pager_evict(Pager *pager) {
+  uint32_t frame_num = pager_try_evict(pager);
+  while (frame_num == INVALID_FRAME && pager->num_loading > 0) {
+    pthread_cond_wait(&pager->loaded, &pager->lock);
+    frame_num = pager_try_evict(pager);
+  }
+  if (frame_num == INVALID_FRAME) {
+    printf("All %d buffer pool frames are pinned.\n", pager->num_frames);
+    exit(EXIT_FAILURE);
+  }
+  return frame_num;
+}
+
+// a read-ahead thread takes frames off the queue and reads their pages
+// until it is told to stop
+void *read_ahead_worker(void *argument) {
+  ReadAhead *read_ahead = argument;
+  pthread_mutex_lock(&read_ahead->lock);
+  while (true) {
+    while (read_ahead->queue_length == 0 && !read_ahead->stop) {
+      pthread_cond_wait(&read_ahead->requested, &read_ahead->lock);
+    }
+    if (read_ahead->queue_length == 0) {
+      break;
+    }
+    uint32_t frame_num = read_ahead->queue[read_ahead->queue_head];
+    read_ahead->queue_head =
+        (read_ahead->queue_head + 1) % read_ahead->queue_capacity;
+    read_ahead->queue_length -= 1;
+    pthread_mutex_unlock(&read_ahead->lock);
+
+    Pager *pager = read_ahead->pager;
+    Frame *frame = &pager->frames[frame_num];
+    pager_read_page(pager, frame->page_num, frame->data);
+
+    pthread_mutex_lock(&pager->lock);
+    frame->loading = false;
+    pager->num_loading -= 1;
+    pthread_cond_broadcast(&pager->loaded);
+    pthread_mutex_unlock(&pager->lock);
+    pthread_mutex_lock(&read_ahead->lock);
+  }
+  pthread_mutex_unlock(&read_ahead->lock);
+  return NULL;
+}
+
+// the threads are only started once a scan asks for read-ahead, called
+// with the pager lock held
+ReadAhead *read_ahead_start(Pager *pager) {
+  if (pager->read_ahead != NULL) {
+    return pager->read_ahead;
+  }
+  ReadAhead *read_ahead = calloc(1, sizeof(ReadAhead));
+  pthread_mutex_init(&read_ahead->lock, NULL);
+  pthread_cond_init(&read_ahead->requested, NULL);
+  read_ahead->pager = pager;
+  read_ahead->queue_capacity = pager->read_ahead_pages;
+  read_ahead->queue = malloc(sizeof(uint32_t) * read_ahead->queue_capacity);
+  for (uint32_t i = 0; i < READ_AHEAD_THREADS; i++) {
+    pthread_create(&read_ahead->threads[i], NULL, read_ahead_worker,
+                   read_ahead);
+  }
+  pager->read_ahead = read_ahead;
+  return read_ahead;
+}
+
+// lets the threads finish the queue and exit
+void read_ahead_stop(ReadAhead *read_ahead) {
+  if (read_ahead == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&read_ahead->lock);
+  read_ahead->stop = true;
+  pthread_cond_broadcast(&read_ahead->requested);
+  pthread_mutex_unlock(&read_ahead->lock);
+  for (uint32_t i = 0; i < READ_AHEAD_THREADS; i++) {
+    pthread_join(read_ahead->threads[i], NULL);
+  }
+  pthread_mutex_destroy(&read_ahead->lock);
+  pthread_cond_destroy(&read_ahead->requested);
+  free(read_ahead->queue);
+  free(read_ahead);
+}
+
+// asks for pages to be loaded in the background. pages that are cached
+// or not in the file yet are skipped, and so are the pages that do not
+// fit in the read-ahead window or for which no frame can be freed. the
+// requests are queued together so the threads are woken once per batch.
+// the mmap pager leaves the reads to the kernel instead
+void pager_read_ahead(Pager *pager, uint32_t *page_nums, uint32_t count) {
+  pthread_mutex_lock(&pager->lock);
+  uint32_t pages_in_file = pager->file_length / pager->page_size;
+  if (pager->map != NULL) {
+    for (uint32_t i = 0; i < count; i++) {
+      if (page_nums[i] < pages_in_file) {
+        madvise(pager->map + (size_t)page_nums[i] * pager->page_size,
+                pager->page_size, MADV_WILLNEED);
+      }
+    }
+    pthread_mutex_unlock(&pager->lock);
+    return;
+  }
+
+  // reads started by get_page count against the window as well
+  ReadAhead *read_ahead = read_ahead_start(pager);
+  uint32_t available = 0;
+  if (pager->num_loading < pager->read_ahead_pages) {
+    available = pager->read_ahead_pages - pager->num_loading;
+  }
+
+  uint32_t frame_nums[count];
+  uint32_t num_queued = 0;
+  for (uint32_t i = 0; i < count && num_queued < available; i++) {
+    uint32_t page_num = page_nums[i];
+    if (page_num >= pages_in_file ||
+        pager_lookup(pager, page_num) != INVALID_FRAME) {
+      continue;
+    }
+    uint32_t frame_num = pager_try_evict(pager);
+    if (frame_num == INVALID_FRAME) {
+      break;
+    }
+
+    // the frame is linked into the hash table right away, so get_page
+    // finds it and waits for the read instead of starting another one
+    Frame *frame = &pager->frames[frame_num];
+    uint32_t bucket = pager_bucket(pager, page_num);
+    frame->page_num = page_num;
+    frame->pin_count = 0;
+    frame->referenced = true;
+    frame->in_use = true;
+    frame->dirty = false;
+    frame->in_txn = false;
+    frame->hash_next = pager->buckets[bucket];
+    pager->buckets[bucket] = frame_num;
+    frame->loading = true;
+    frame_nums[num_queued++] = frame_num;
+  }
+  pager->num_loading += num_queued;
+  pthread_mutex_unlock(&pager->lock);
+  if (num_queued == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&read_ahead->lock);
+  for (uint32_t i = 0; i < num_queued; i++) {
+    uint32_t tail = (read_ahead->queue_head + read_ahead->queue_length) %
+                    read_ahead->queue_capacity;
+    read_ahead->queue[tail] = frame_nums[i];
+    read_ahead->queue_length += 1;
+  }
+  pthread_cond_broadcast(&read_ahead->requested);
+  pthread_mutex_unlock(&read_ahead->lock);
+}
+
+// mmap pager backend, the page is a pointer straight into the mapping of
+// the database file so a warm page costs no copy and no syscall. a page
+// past the end of the file grows the file first and the mapping when
+// the reservation is used up. the mapping never moves so pointers handed
+// out earlier stay valid
+void *pager_map_page(Pager *pager, uint32_t page_num) {
+  if (page_num >= pager->num_pages) {
+    size_t new_length = ((size_t)page_num + 1) * pager->page_size;
+    if (new_length > pager->map_capacity) {
+      size_t new_capacity = pager->map_capacity;
+      while (new_capacity < new_length) {
+        new_capacity *= 2;
+      }
+      if (mremap(pager->map, pager->map_capacity, new_capacity, 0) ==
+          MAP_FAILED) {
+        printf("Error growing the mapping: %d\n", errno);
+        exit(EXIT_FAILURE);
+      }
+      pager->map_capacity = new_capacity;
+    }
+
+    if (ftruncate(pager->file_descriptor, new_length) == -1) {
+      printf("Error growing the db file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    pager->file_length = new_length;
+    pager->num_pages = page_num + 1;
+  }
+
+  return pager->map + (size_t)page_num * pager->page_size;
+}
+
+// the mmap pager has no frames, the latches of its pages live in chunks
+// which are allocated on first use and never move. called with the
+// pager lock held
+pthread_rwlock_t *pager_map_latch(Pager *pager, uint32_t page_num) {
+  uint32_t chunk = page_num / MAP_LATCH_CHUNK;
+  if (chunk >= pager->num_map_latch_chunks) {
+    uint32_t old_chunks = pager->num_map_latch_chunks;
+    while (chunk >= pager->num_map_latch_chunks) {
+      pager->num_map_latch_chunks = 2 * pager->num_map_latch_chunks + 8;
+    }
+    pager->map_latches =
+        realloc(pager->map_latches,
+                sizeof(pthread_rwlock_t *) * pager->num_map_latch_chunks);
+    memset(pager->map_latches + old_chunks, 0,
+           sizeof(pthread_rwlock_t *) *
+               (pager->num_map_latch_chunks - old_chunks));
+  }
+  if (pager->map_latches[chunk] == NULL) {
+    pager->map_latches[chunk] =
+        malloc(sizeof(pthread_rwlock_t) * MAP_LATCH_CHUNK);
+    for (uint32_t i = 0; i < MAP_LATCH_CHUNK; i++) {
+      latch_init(&pager->map_latches[chunk][i]);
+    }
+  }
+  return &pager->map_latches[chunk][page_num % MAP_LATCH_CHUNK];
+}
+
+// the logic to retrive contents from the pager.
+// it acts like a cache, on a miss it picks a frame in the buffer pool and
+// reads the page from the disk into it, otherwise returns the cached frame.
+// the returned page is pinned and stays in memory until unpin_page is called.
+// when latch is not NULL it is pointed at the latch of the page
+void *pager_fetch(Pager *pager, uint32_t page_num, pthread_rwlock_t **latch) {
+  pthread_mutex_lock(&pager->lock);
+  if (pager->map != NULL) {
+    void *page = pager_map_page(pager, page_num);
+    if (latch != NULL) {
+      *latch = pager_map_latch(pager, page_num);
+    }
+    pthread_mutex_unlock(&pager->lock);
+    return page;
+  }
+
+  // check if we have the content in the pager cache. a frame another
+  // thread is still reading into is waited for and looked up again, it
+  // may be evicted before we get to run
+  uint32_t frame_num = pager_lookup(pager, page_num);
+  while (frame_num != INVALID_FRAME && pager->frames[frame_num].loading) {
+    pthread_cond_wait(&pager->loaded, &pager->lock);
+    frame_num = pager_lookup(pager, page_num);
+  }
+  if (frame_num != INVALID_FRAME) {
+    stats_add(&pager->stats.page_hits, 1);
+    Frame *frame = &pager->frames[frame_num];
+    frame->pin_count += 1;
+    frame->referenced = true;
+    if (latch != NULL) {
+      *latch = &frame->latch;
+    }
+    pthread_mutex_unlock(&pager->lock);
+    return frame->data;
+  }
+
+  // this case is for missed cache
+  stats_add(&pager->stats.page_misses, 1);
+  frame_num = pager_evict(pager);
+  Frame *frame = &pager->frames[frame_num];
+
+  // we store the page in the frame and link it into the hash table
+  // before reading it, so other threads asking for the page wait for
+  // this read instead of starting their own
+  uint32_t bucket = pager_bucket(pager, page_num);
+  frame->page_num = page_num;
+  frame->pin_count = 1;
+  frame->referenced = true;
+  frame->in_use = true;
+  frame->dirty = false;
+  frame->in_txn = false;
+  frame->hash_next = pager->buckets[bucket];
+  pager->buckets[bucket] = frame_num;
+
+  // if we get page number higher than current page we
+  // increment the max number of pages for the pager
+  if (page_num >= pager->num_pages) {
+    pager->num_pages = page_num + 1;
+  }
+
+  if (pager->page_map != NULL) {
+    pager_read_page(pager, page_num, frame->data);
+  } else {
+    frame->loading = true;
+    pager->num_loading += 1;
+    pthread_mutex_unlock(&pager->lock);
+    pager_read_page(pager, page_num, frame->data);
+    pthread_mutex_lock(&pager->lock);
+    frame->loading = false;
+    pager->num_loading -= 1;
+    pthread_cond_broadcast(&pager->loaded);
+  }
+
+  if (latch != NULL) {
+    *latch = &frame->latch;
+  }
+  pthread_mutex_unlock(&pager->lock);
+  // we return the specific page
+  return frame->data;
+}
+
+void *get_page(Pager *pager, uint32_t page_num) {
+  return pager_fetch(pager, page_num, NULL);
+}
+
+// releases a page returned by get_page, once the pin count drops to
+// zero the frame may be picked for eviction
+void unpin_page(Pager *pager, uint32_t page_num) {
+  if (pager->map != NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pager->lock);
+  uint32_t frame_num = pager_lookup(pager, page_num);
+  if (frame_num == INVALID_FRAME || pager->frames[frame_num].pin_count == 0) {
+    printf("Tried to unpin page %d which is not pinned\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+  pager->frames[frame_num].pin_count -= 1;
+  pthread_mutex_unlock(&pager->lock);
+}
+
+// records that a pinned page was modified, only dirty pages are
+// written back on eviction, checkpoint and close. with the log enabled
+// the page also joins the running statement so it is logged on commit
+void mark_page_dirty(Pager *pager, uint32_t page_num) {
+  pthread_mutex_lock(&pager->lock);
+  // the mmap pager keeps one dirty bit per page of the file instead
+  if (pager->map != NULL) {
+    if (page_num / 8 >= pager->dirty_map_capacity) {
+      uint32_t old_capacity = pager->dirty_map_capacity;
+      while (page_num / 8 >= pager->dirty_map_capacity) {
+        pager->dirty_map_capacity = 2 * pager->dirty_map_capacity + 64;
+      }
+      pager->dirty_map = realloc(pager->dirty_map, pager->dirty_map_capacity);
+      memset(pager->dirty_map + old_capacity, 0,
+             pager->dirty_map_capacity - old_capacity);
+    }
+    if (!(pager->dirty_map[page_num / 8] & (1 << (page_num % 8)))) {
+      pager->dirty_map[page_num / 8] |= 1 << (page_num % 8);
+      pager->num_dirty += 1;
+    }
+    pthread_mutex_unlock(&pager->lock);
+    return;
+  }
+
+  Frame *frame = &pager->frames[pager_lookup(pager, page_num)];
+  if (!frame->dirty) {
+    frame->dirty = true;
+    pager->num_dirty += 1;
+  }
+
+  if (pager->wal != NULL && !frame->in_txn) {
+    frame->in_txn = true;
+    if (pager->txn_num_pages == pager->txn_capacity) {
+      pager->txn_capacity = 2 * pager->txn_capacity + 16;
+      pager->txn_pages =
+          realloc(pager->txn_pages, sizeof(uint32_t) * pager->txn_capacity);
+    }
+    pager->txn_pages[pager->txn_num_pages++] = page_num;
+  }
+  pthread_mutex_unlock(&pager->lock);
+}
+
+// ends the running statement, the images of the pages it changed are
+// appended to the log and the pages may be evicted again afterwards
+void pager_commit(Pager *pager) {
+  if (pager->wal == NULL || pager->txn_num_pages == 0) {
+    return;
+  }
+
+  // the log is shared with evictions, which sync it before writing
+  pthread_mutex_lock(&pager->lock);
+  for (uint32_t i = 0; i < pager->txn_num_pages; i++) {
+    uint32_t page_num = pager->txn_pages[i];
+    Frame *frame = &pager->frames[pager_lookup(pager, page_num)];
+    bool commit = i == pager->txn_num_pages - 1;
+    wal_stage_frame(pager->wal, page_num, frame->data, commit);
+    frame->in_txn = false;
+  }
+  pager->txn_num_pages = 0;
+  wal_commit(pager->wal);
+  pthread_mutex_unlock(&pager->lock);
+}
+
+// with the log enabled every page a statement writes can not be evicted
+// until it commits, so long running work like a load or a large insert
+// is committed in pieces whenever the tree is consistent
+void pager_commit_if_large(Pager *pager) {
+  if (pager->txn_num_pages >= pager->num_frames / 2) {
+    pager_commit(pager);
+  }
+}
+
+// checkpoint of the mmap pager, every run of adjacent dirty pages is
+// written and synced with one msync over that range of the mapping
+uint32_t pager_map_checkpoint(Pager *pager) {
+  uint32_t pages_written = 0;
+  uint32_t page_num = 0;
+  uint32_t max_page = pager->dirty_map_capacity * 8;
+  if (max_page > pager->num_pages) {
+    max_page = pager->num_pages;
+  }
+
+  while (page_num < max_page) {
+    if (!(pager->dirty_map[page_num / 8] & (1 << (page_num % 8)))) {
+      page_num += 1;
+      continue;
+    }
+    uint32_t run_start = page_num;
+    while (page_num < max_page &&
+           (pager->dirty_map[page_num / 8] & (1 << (page_num % 8)))) {
+      pager->dirty_map[page_num / 8] &= ~(1 << (page_num % 8));
+      page_num += 1;
+    }
+
+    if (msync(pager->map + (size_t)run_start * pager->page_size,
+              (size_t)(page_num - run_start) * pager->page_size,
+              MS_SYNC) == -1) {
+      printf("Error syncing mapping: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    pages_written += page_num - run_start;
+    stats_add(&pager->stats.pages_written, page_num - run_start);
+    stats_add(&pager->stats.bytes_written,
+              (uint64_t)(page_num - run_start) * pager->page_size);
+  }
+
+  pager->num_dirty = 0;
+  pager->last_checkpoint = time(NULL);
+  return pages_written;
+}
+
+// orders page numbers for qsort
+int compare_page_nums(const void *a, const void *b) {
+  uint32_t page_a = *(const uint32_t *)a;
+  uint32_t page_b = *(const uint32_t *)b;
+  return (page_a > page_b) - (page_a < page_b);
+}
+
+// writes every dirty frame back to the database file. the pages are
+// sorted by page number first so each run of adjacent pages goes out
+// with a single pwritev, after a large load a checkpoint costs a few
+// system calls rather than a seek and a write per page. pages of a
+// compressed file move around, they are written one at a time
+uint32_t pager_write_back(Pager *pager) {
+  pthread_mutex_lock(&pager->lock);
+  uint32_t *page_nums = malloc(sizeof(uint32_t) * pager->num_frames);
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    if (pager->frames[i].in_use && pager->frames[i].dirty) {
+      page_nums[count++] = pager->frames[i].page_num;
+    }
+  }
+  qsort(page_nums, count, sizeof(uint32_t), compare_page_nums);
+
+  // one log sync covers the whole batch instead of one per page
+  if (pager->wal != NULL) {
+    wal_sync(pager->wal);
+  }
+
+  if (pager->page_map != NULL) {
+    for (uint32_t i = 0; i < count; i++) {
+      pager_write_frame(pager, pager_lookup(pager, page_nums[i]));
+    }
+    pthread_mutex_unlock(&pager->lock);
+    free(page_nums);
+    return count;
+  }
+
+  // the frames are pinned and marked clean before the lock is let go, so
+  // other threads keep using the pool during the writes. checkpoints run
+  // between writes, nothing changes the pages in the meantime
+  void **pages = malloc(sizeof(void *) * count);
+  for (uint32_t i = 0; i < count; i++) {
+    Frame *frame = &pager->frames[pager_lookup(pager, page_nums[i])];
+    frame->pin_count += 1;
+    frame->dirty = false;
+    pages[i] = frame->data;
+  }
+  pager->num_dirty -= count;
+  pthread_mutex_unlock(&pager->lock);
+
+  struct iovec iov[IOV_MAX];
+  uint32_t end_of_file = 0;
+  uint32_t i = 0;
+  while (i < count) {
+    uint32_t run_start = page_nums[i];
+    uint32_t run_length = 0;
+    while (i < count && page_nums[i] == run_start + run_length &&
+           run_length < IOV_MAX) {
+      iov[run_length].iov_base = pages[i];
+      iov[run_length].iov_len = pager->page_size;
+      run_length += 1;
+      i += 1;
+    }
+
+    ssize_t length = (ssize_t)run_length * pager->page_size;
+    if (pwritev(pager->file_descriptor, iov, run_length,
+                (off_t)run_start * pager->page_size) != length) {
+      printf("Error writing: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    stats_add(&pager->stats.pages_written, run_length);
+    stats_add(&pager->stats.bytes_written, length);
+    end_of_file = (run_start + run_length) * pager->page_size;
+  }
+
+  pthread_mutex_lock(&pager->lock);
+  for (uint32_t i = 0; i < count; i++) {
+    pager->frames[pager_lookup(pager, page_nums[i])].pin_count -= 1;
+  }
+  if (end_of_file > pager->file_length) {
+    pager->file_length = end_of_file;
+  }
+  pthread_mutex_unlock(&pager->lock);
+  free(pages);
+  free(page_nums);
+  return count;
+}
+
+// writes every dirty page in the buffer pool to the disk and returns
+// how many pages were written, clean pages are left alone so the cost
+// follows the size of the changes rather than the size of the cache
+uint32_t pager_checkpoint(Pager *pager) {
+  uint64_t start = stats_now();
+  if (pager->map != NULL) {
+    pthread_mutex_lock(&pager->lock);
+    uint32_t pages_written = pager_map_checkpoint(pager);
+    pthread_mutex_unlock(&pager->lock);
+    latency_record(&pager->stats.checkpoint, start);
+    return pages_written;
+  }
+
+  uint32_t pages_written = pager_write_back(pager);
+
+  // once the pages are durable in the database file the log
+  // describing them is no longer needed and can be truncated
+  pager_sync(pager);
+  pthread_mutex_lock(&pager->lock);
+  if (pager->wal != NULL) {
+    wal_reset(pager->wal);
+  }
+  pager->last_checkpoint = time(NULL);
+  pthread_mutex_unlock(&pager->lock);
+  latency_record(&pager->stats.checkpoint, start);
+  return pages_written;
+}
+
+// runs a checkpoint once enough pages are dirty or enough time passed
+// since the last one, it is called between statements so a crash only
+// loses the work done since the last checkpoint
+void pager_maybe_checkpoint(Pager *pager) {
+  pthread_mutex_lock(&pager->lock);
+  bool too_many_dirty = pager->checkpoint_pages > 0 &&
+                        pager->num_dirty >= pager->checkpoint_pages;
+  bool too_old = pager->checkpoint_seconds > 0 &&
+                 time(NULL) - pager->last_checkpoint >=
+                     (time_t)pager->checkpoint_seconds;
+  bool log_too_long = pager->wal != NULL &&
+                      pager->wal->num_frames >= WAL_AUTOCHECKPOINT_FRAMES;
+  bool dirty = pager->num_dirty > 0;
+  pthread_mutex_unlock(&pager->lock);
+  if (dirty && (too_many_dirty || too_old || log_too_long)) {
+    pager_checkpoint(pager);
+  }
+}
+
+// searches the keys of a leaf for the cell holding key, or the position
+// where it must be inserted incase we dont find it
+uint32_t leaf_node_find_cell(void *node, uint32_t key) {
+  return key_search(leaf_node_keys(node), *leaf_node_num_cells(node), key);
+}
+
+// returns the cursor to the location of where row is
+// or where it must be incase we dont find it
+Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key) {
+  void *node = get_page(table->pager, page_num);
+
+  Cursor *cursor = malloc(sizeof(Cursor));
+  cursor->table = table;
+  cursor->page_num = page_num;
+  cursor->cell_num = leaf_node_find_cell(node, key);
+  cursor->depth = 0;
+  cursor->num_latched = 0;
+
+  unpin_page(table->pager, page_num);
+  return cursor;
+}
+
+// this method is used to initialize a cursor
+// at the 0th row of the table
+// returns the position for a given key
+// if no key, it gives us the position where it should be inserted.
+// starting at the root we binary search every internal node on the way
+// down and follow the child which covers the key until we reach a leaf,
+// the internal nodes we passed are remembered in the cursor
+Cursor *table_find(Table *table, uint32_t key) {
+  uint32_t path[BTREE_MAX_DEPTH];
+  uint32_t depth = 0;
+  uint32_t leaf_max_key = UINT32_MAX;
+  uint32_t page_num = table->root_page_num;
+  void *node = get_page(table->pager, page_num);
+
+  while (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t child_index = internal_node_find_child(node, key);
+    uint32_t child_page_num = *internal_node_child(node, child_index);
+    // the key of the child we take bounds it, the right child keeps the
+    // bound of its parent
+    if (child_index < *internal_node_num_keys(node)) {
+      leaf_max_key = *internal_node_key(node, child_index);
+    }
+    unpin_page(table->pager, page_num);
+    path[depth++] = page_num;
+    page_num = child_page_num;
+    node = get_page(table->pager, page_num);
+  }
+  unpin_page(table->pager, page_num);
+
+  Cursor *cursor = leaf_node_find(table, page_num, key);
+  memcpy(cursor->path, path, depth * sizeof(uint32_t));
+  cursor->depth = depth;
+  cursor->leaf_max_key = leaf_max_key;
+  return cursor;
+}
+
+// pins a page and takes its latch for the cursor, both are held until
+// cursor_unlatch or cursor_close
+void *cursor_latch(Cursor *cursor, uint32_t page_num, LatchMode mode) {
+  pthread_rwlock_t *latch;
+  void *page = pager_fetch(cursor->table->pager, page_num, &latch);
+  if (mode == LATCH_SHARED) {
+    pthread_rwlock_rdlock(latch);
+  } else {
+    pthread_rwlock_wrlock(latch);
+  }
+  cursor->latched_pages[cursor->num_latched] = page_num;
+  cursor->latches[cursor->num_latched] = latch;
+  cursor->num_latched += 1;
+  return page;
+}
+
+// lets go of the latch and the pin the cursor holds on a page, if any
+void cursor_unlatch(Cursor *cursor, uint32_t page_num) {
+  for (uint32_t i = 0; i < cursor->num_latched; i++) {
+    if (cursor->latched_pages[i] != page_num) {
+      continue;
+    }
+    pthread_rwlock_unlock(cursor->latches[i]);
+    unpin_page(cursor->table->pager, page_num);
+    cursor->num_latched -= 1;
+    memmove(&cursor->latched_pages[i], &cursor->latched_pages[i + 1],
+            (cursor->num_latched - i) * sizeof(uint32_t));
+    memmove(&cursor->latches[i], &cursor->latches[i + 1],
+            (cursor->num_latched - i) * sizeof(pthread_rwlock_t *));
+    return;
+  }
+}
+
+// lets go of all but the keep latches the cursor took last
+void cursor_unlatch_all_but(Cursor *cursor, uint32_t keep) {
+  while (cursor->num_latched > keep) {
+    cursor_unlatch(cursor, cursor->latched_pages[0]);
+  }
+}
+
+void cursor_close(Cursor *cursor) {
+  cursor_unlatch_all_but(cursor, 0);
+  free(cursor);
+}
+
+// whether a node on the path of a write takes the change coming up from
+// its child without splitting or merging itself. a write only descends
+// this way once its leaf turned out to need a split or a merge, so
+// leaves never count as safe
+bool node_is_safe(Pager *pager, void *node, Descent descent) {
+  if (get_node_type(node) == NODE_LEAF) {
+    return false;
+  }
+  uint32_t num_keys = *internal_node_num_keys(node);
+  switch (descent) {
+    case DESCEND_INSERT:
+      return num_keys < pager->internal_node_max_keys;
+    case DESCEND_DELETE:
+      return num_keys >
+             (is_node_root(node) ? 1 : pager->internal_node_min_keys);
+    default:
+      return false;
+  }
+}
+
+// descends from the root to the leaf covering key like table_find, but
+// with latch crabbing: the latch of a child is taken before the one of
+// its parent is let go, so no writer can change the path in between.
+// the latches the descent keeps are held until cursor_close
+Cursor *table_seek(Table *table, uint32_t key, Descent descent) {
+  Pager *pager = table->pager;
+  LatchMode mode = descent >= DESCEND_INSERT ? LATCH_EXCLUSIVE : LATCH_SHARED;
+  Cursor *cursor = malloc(sizeof(Cursor));
+  cursor->table = table;
+  cursor->depth = 0;
+  cursor->leaf_max_key = UINT32_MAX;
+  cursor->num_latched = 0;
+
+  uint32_t page_num = table->root_page_num;
+  void *node = cursor_latch(cursor, page_num, mode);
+  while (true) {
+    bool is_leaf = get_node_type(node) == NODE_LEAF;
+    // a writer only learns that a node is a leaf once it holds it, so the
+    // latch is taken again alone while the parent is still held. writers
+    // take turns, no one else can change the leaf in between
+    if (is_leaf && descent == DESCEND_WRITE_LEAF) {
+      cursor_unlatch(cursor, page_num);
+      node = cursor_latch(cursor, page_num, LATCH_EXCLUSIVE);
+    }
+    if (descent <= DESCEND_WRITE_LEAF) {
+      // a scan keeps the parent of its leaf for the read-ahead
+      bool keep_parent = is_leaf && descent == DESCEND_SCAN;
+      cursor_unlatch_all_but(cursor, keep_parent ? 2 : 1);
+    } else if (node_is_safe(pager, node, descent)) {
+      cursor_unlatch_all_but(cursor, 1);
+    }
+    if (is_leaf) {
+      break;
+    }
+
+    uint32_t child_index = internal_node_find_child(node, key);
+    // the key of the child we take bounds it, the right child keeps the
+    // bound of its parent
+    if (child_index < *internal_node_num_keys(node)) {
+      cursor->leaf_max_key = *internal_node_key(node, child_index);
+    }
+    cursor->path[cursor->depth++] = page_num;
+    page_num = *internal_node_child(node, child_index);
+    node = cursor_latch(cursor, page_num, mode);
+  }
+
+  cursor->page_num = page_num;
+  cursor->cell_num = leaf_node_find_cell(node, key);
+  return cursor;
+}
+
+// looks up the row with the given id and copies it out, returns false if
+// there is none. any number of threads may read while another one writes
+bool table_get(Table *table, uint32_t key, Row *row) {
+  Cursor *cursor = table_seek(table, key, DESCEND_READ);
+  void *node = get_page(table->pager, cursor->page_num);
+  bool found = cursor->cell_num < *leaf_node_num_cells(node) &&
+               *leaf_node_key(node, cursor->cell_num) == key;
+  if (found) {
+    leaf_node_read_row(node, cursor->cell_num, row);
+  }
+  unpin_page(table->pager, cursor->page_num);
+  cursor_close(cursor);
+  return found;
+}
+
+// called by a scan holding the leaf it is about to read and its parent.
+// the leaves after it are the next children of the parent, so up to
+// read_ahead_pages of them are requested ahead of the scan, stopping at
+// the first child past the end of the scan. the window is refilled once
+// half of it was used up, window_parent and window_next remember which
+// children were requested already
+void scan_read_ahead(Cursor *cursor, uint32_t key, uint32_t end,
+                     uint32_t *window_parent, uint32_t *window_next) {
+  Pager *pager = cursor->table->pager;
+  if (pager->read_ahead_pages == 0 || cursor->depth == 0) {
+    return;
+  }
+
+  uint32_t parent_page_num = cursor->path[cursor->depth - 1];
+  void *parent = get_page(pager, parent_page_num);
+  uint32_t index = internal_node_find_child(parent, key);
+  if (*window_parent != parent_page_num) {
+    *window_parent = parent_page_num;
+    *window_next = 0;
+  }
+
+  uint32_t window = pager->read_ahead_pages;
+  uint32_t num_keys = *internal_node_num_keys(parent);
+  uint32_t child = index + 1;
+  if (*window_next > index + window / 2) {
+    unpin_page(pager, parent_page_num);
+    return;
+  }
+  if (child < *window_next) {
+    child = *window_next;
+  }
+  uint32_t page_nums[window];
+  uint32_t count = 0;
+  for (; child <= num_keys && child <= index + window; child++) {
+    if (*internal_node_key(parent, child - 1) >= end) {
+      break;
+    }
+    page_nums[count++] = *internal_node_child(parent, child);
+  }
+  *window_next = child;
+  unpin_page(pager, parent_page_num);
+  pager_read_ahead(pager, page_nums, count);
+}
+
+// calls back with every row whose id lies between start and end, in id
+// order, and returns how many there were. the scan descends to one leaf
+// at a time, copies its rows out and lets go of the latch before calling
+// back, then descends again for the keys after the leaf. writers never
+// wait for the callback, and a leaf that was split or merged between two
+// descents is found through its parent like any other
+uint32_t table_scan(Table *table, uint32_t start, uint32_t end,
+                    RowCallback callback, void *argument) {
+  Pager *pager = table->pager;
+  Row *rows = NULL;
+  uint32_t capacity = 0;
+  uint32_t num_scanned = 0;
+  uint32_t window_parent = 0;
+  uint32_t window_next = 0;
+  uint32_t key = start;
+
+  while (key <= end) {
+    Cursor *cursor = table_seek(table, key, DESCEND_SCAN);
+    if (cursor->depth > 0) {
+      scan_read_ahead(cursor, key, end, &window_parent, &window_next);
+      cursor_unlatch(cursor, cursor->path[cursor->depth - 1]);
+    }
+
+    void *node = get_page(pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells > capacity) {
+      capacity = num_cells;
+      rows = realloc(rows, capacity * sizeof(Row));
+    }
+    uint32_t num_rows = 0;
+    for (uint32_t i = cursor->cell_num; i < num_cells; i++) {
+      if (*leaf_node_key(node, i) > end) {
+        break;
+      }
+      leaf_node_read_row(node, i, &rows[num_rows++]);
+    }
+    unpin_page(pager, cursor->page_num);
+    uint32_t leaf_max_key = cursor->leaf_max_key;
+    cursor_close(cursor);
+
+    for (uint32_t i = 0; i < num_rows; i++) {
+      callback(&rows[i], argument);
+    }
+    num_scanned += num_rows;
+    // the rightmost leaf is bounded by UINT32_MAX, which ends the scan
+    if (leaf_max_key >= end) {
+      break;
+    }
+    key = leaf_max_key + 1;
+  }
+
+  free(rows);
+  return num_scanned;
+}
+
+// a write runs between table_write_begin and table_write_end, which
+// commits it. writers take turns, readers never wait for them here
+void table_write_begin(Table *table) {
+  pthread_mutex_lock(&table->write_lock);
+}
+
+void table_write_end(Table *table) {
+  pager_commit(table->pager);
+  pager_maybe_checkpoint(table->pager);
+  pthread_mutex_unlock(&table->write_lock);
+}
+
+// a write added or removed rows, called with the write lock held
+void table_count_rows(Table *table, int64_t delta) {
+  pthread_mutex_lock(&table->count_lock);
+  table->row_count += delta;
+  pthread_mutex_unlock(&table->count_lock);
+}
+
+// a write changed one of the counters of table->shape, called with the
+// write lock held. the stats read them without it
+void table_shape_add(uint64_t *counter, int64_t delta) {
+  __atomic_fetch_add(counter, (uint64_t)delta, __ATOMIC_RELAXED);
+}
+
+// orders ids, which are the keys of the tree, for qsort
+int compare_ids(const void *a, const void *b) {
+  uint32_t id_a = *(const uint32_t *)a;
+  uint32_t id_b = *(const uint32_t *)b;
+  return (id_a > id_b) - (id_a < id_b);
+}
+
+// cuts [start, end] into at most max_ranges ranges which hold about the
+// same number of leaves, range i starts at starts[i] and ends right
+// before range i + 1. the separator keys of the upper levels of the tree
+// are the boundaries, one level after another is read until there are
+// enough of them or the next level is the leaves. the tree may change
+// meanwhile, which only makes the ranges less even
+uint32_t table_split_range(Table *table, uint32_t start, uint32_t end,
+                           uint32_t max_ranges, uint32_t *starts) {
+  Cursor *cursor = malloc(sizeof(Cursor));
+  cursor->table = table;
+  cursor->num_latched = 0;
+  uint32_t *pages = malloc(sizeof(uint32_t));
+  uint32_t num_pages = 1;
+  pages[0] = table->root_page_num;
+  uint32_t *keys = NULL;
+  uint32_t num_keys = 0;
+
+  while (num_keys + 1 < max_ranges) {
+    void *node = cursor_latch(cursor, pages[0], LATCH_SHARED);
+    bool is_leaf = get_node_type(node) == NODE_LEAF;
+    cursor_unlatch(cursor, pages[0]);
+    if (is_leaf) {
+      break;
+    }
+
+    uint32_t *children = NULL;
+    uint32_t num_children = 0;
+    for (uint32_t i = 0; i < num_pages; i++) {
+      node = cursor_latch(cursor, pages[i], LATCH_SHARED);
+      // a writer may have turned it into a leaf since we looked
+      if (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t node_keys = *internal_node_num_keys(node);
+        keys = realloc(keys, (num_keys + node_keys) * sizeof(uint32_t));
+        children = realloc(children, (num_children + node_keys + 1) *
+                                         sizeof(uint32_t));
+        for (uint32_t j = 0; j <= node_keys; j++) {
+          if (j < node_keys) {
+            keys[num_keys++] = *internal_node_key(node, j);
+          }
+          children[num_children++] = *internal_node_child(node, j);
+        }
+      }
+      cursor_unlatch(cursor, pages[i]);
+    }
+    free(pages);
+    pages = children;
+    num_pages = num_children;
+    if (num_pages == 0) {
+      break;
+    }
+  }
+  free(pages);
+  cursor_close(cursor);
+
+  // only the boundaries inside the range count, a separator is the
+  // largest key on its left
+  uint32_t num_inside = 0;
+  for (uint32_t i = 0; i < num_keys; i++) {
+    if (keys[i] >= start && keys[i] < end) {
+      keys[num_inside++] = keys[i];
+    }
+  }
+  qsort(keys, num_inside, sizeof(uint32_t), compare_ids);
+
+  uint32_t num_ranges =
+      num_inside + 1 < max_ranges ? num_inside + 1 : max_ranges;
+  starts[0] = start;
+  for (uint32_t i = 1; i < num_ranges; i++) {
+    starts[i] = keys[(uint64_t)i * (num_inside + 1) / num_ranges - 1] + 1;
+  }
+  free(keys);
+  return num_ranges;
+}
+
+// whether child i of an internal node may hold keys in [start, end].
+// the keys of child i lie above key i - 1 and up to key i
+bool internal_node_child_overlaps(void *node, uint32_t i, uint32_t start,
+                                  uint32_t end) {
+  if (i > 0 && *internal_node_key(node, i - 1) >= end) {
+    return false;
+  }
+  return i == *internal_node_num_keys(node) ||
+         *internal_node_key(node, i) >= start;
+}
+
+// the cells of a leaf with keys in [start, end] are the ones from first
+// up to before past
+void leaf_node_cells_in_range(void *node, uint32_t start, uint32_t end,
+                              uint32_t *first, uint32_t *past) {
+  *first = leaf_node_find_cell(node, start);
+  *past = leaf_node_find_cell(node, end);
+  if (*past < *leaf_node_num_cells(node) &&
+      *leaf_node_key(node, *past) == end) {
+    *past += 1;
+  }
+  if (*past < *first) {
+    *past = *first;
+  }
+}
+
+// counts the keys in [start, end] below page_num from the cell counts in
+// the leaf headers, the keys are only looked at in the two leaves at the
+// edges of the range and no row is read. the path down to the node is
+// held by the cursor, so no writer can take a node away under us
+uint64_t subtree_count(Cursor *cursor, uint32_t page_num, uint32_t start,
+                       uint32_t end) {
+  void *node = cursor_latch(cursor, page_num, LATCH_SHARED);
+  uint64_t count = 0;
+  if (get_node_type(node) == NODE_LEAF) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells > 0 && *leaf_node_key(node, 0) >= start &&
+        *leaf_node_key(node, num_cells - 1) <= end) {
+      count = num_cells;
+    } else {
+      uint32_t first, past;
+      leaf_node_cells_in_range(node, start, end, &first, &past);
+      count = past - first;
+    }
+  } else {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      if (internal_node_child_overlaps(node, i, start, end)) {
+        count += subtree_count(cursor, *internal_node_child(node, i), start,
+                               end);
+      }
+    }
+  }
+  cursor_unlatch(cursor, page_num);
+  return count;
+}
+
+// finds the smallest key in [start, end] below page_num, or the largest
+// one if last is set. only the subtrees at the edge of the range are
+// visited, usually a single path. returns false if there is no such key
+bool subtree_edge_key(Cursor *cursor, uint32_t page_num, uint32_t start,
+                      uint32_t end, bool last, uint32_t *key) {
+  void *node = cursor_latch(cursor, page_num, LATCH_SHARED);
+  bool found = false;
+  if (get_node_type(node) == NODE_LEAF) {
+    uint32_t first, past;
+    leaf_node_cells_in_range(node, start, end, &first, &past);
+    if (first < past) {
+      *key = *leaf_node_key(node, last ? past - 1 : first);
+      found = true;
+    }
+  } else {
+    uint32_t num_children = *internal_node_num_keys(node) + 1;
+    for (uint32_t j = 0; j < num_children && !found; j++) {
+      uint32_t i = last ? num_children - 1 - j : j;
+      if (internal_node_child_overlaps(node, i, start, end)) {
+        found = subtree_edge_key(cursor, *internal_node_child(node, i), start,
+                                 end, last, key);
+      }
+    }
+  }
+  cursor_unlatch(cursor, page_num);
+  return found;
+}
+
+// the smallest and largest key in [start, end] and, with count set, how
+// many keys there are, answered from the tree structure without reading
+// any row. returns false if the range holds no key
+bool table_aggregate(Table *table, uint32_t start, uint32_t end, bool count,
+                     uint64_t *num_keys, uint32_t *min_key,
+                     uint32_t *max_key) {
+  Cursor *cursor = malloc(sizeof(Cursor));
+  cursor->table = table;
+  cursor->num_latched = 0;
+  bool found = start <= end &&
+               subtree_edge_key(cursor, table->root_page_num, start, end,
+                                false, min_key) &&
+               subtree_edge_key(cursor, table->root_page_num, start, end,
+                                true, max_key);
+  *num_keys = 0;
+  if (found && count && start == 0 && end == UINT32_MAX) {
+    // the first count of the whole table keeps the writers out, so that
+    // none of them changes it between the walk and row_count being set
+    pthread_mutex_lock(&table->count_lock);
+    if (!table->row_count_known) {
+      pthread_mutex_unlock(&table->count_lock);
+      pthread_mutex_lock(&table->write_lock);
+      uint64_t row_count = subtree_count(cursor, table->root_page_num, 0,
+                                         UINT32_MAX);
+      pthread_mutex_lock(&table->count_lock);
+      table->row_count = row_count;
+      table->row_count_known = true;
+      pthread_mutex_unlock(&table->write_lock);
+    }
+    *num_keys = table->row_count;
+    pthread_mutex_unlock(&table->count_lock);
+  } else if (found && count) {
+    *num_keys = subtree_count(cursor, table->root_page_num, *min_key,
+                              *max_key);
+  }
+  cursor_close(cursor);
+  return found;
+}
+
+typedef struct ParallelScan ParallelScan;
+
+// what a parallel scan found in one of its ranges. rows are only kept
+// when the scan returns them
+typedef struct {
+  ParallelScan *scan;
+  uint64_t count;
+  uint32_t min_id;
+  uint32_t max_id;
+  Row *rows;
+  uint32_t num_rows;
+  uint32_t capacity;
+} ScanPartial;
+
+// a scan of [start, end] split into ranges, the workers take the ranges
+// one at a time through next_range and every range gets its own partial
+// result. the calling thread merges the finished partials in key order
+// through next_merge while the workers go on. a range is only taken
+// when it is less than window ranges past next_merge, which bounds how
+// many ranges hold rows that were not handed to the callback yet
+struct ParallelScan {
+  Table *table;
+  StringColumn column;
+  char *value;
+  bool keep_rows;
+  uint32_t end;
+  RowCallback callback;
+  void *argument;
+  ScanPartial *result;
+  uint32_t starts[MAX_SCAN_THREADS * SCAN_RANGES_PER_THREAD];
+  ScanPartial partials[MAX_SCAN_THREADS * SCAN_RANGES_PER_THREAD];
+  bool done[MAX_SCAN_THREADS * SCAN_RANGES_PER_THREAD];
+  uint32_t num_ranges;
+  uint32_t next_range;
+  uint32_t next_merge;
+  uint32_t window;
+  pthread_mutex_t lock;
+  pthread_cond_t merged;
+};
+
+void parallel_scan_row(Row *row, void *argument) {
+  ScanPartial *partial = argument;
+  ParallelScan *scan = partial->scan;
+  if (scan->value != NULL &&
+      strcmp(row_column(row, scan->column), scan->value) != 0) {
+    return;
+  }
+  // the rows of a range come in key order
+  if (partial->count == 0) {
+    partial->min_id = row->id;
+  }
+  partial->max_id = row->id;
+  partial->count += 1;
+  if (scan->keep_rows) {
+    if (partial->num_rows == partial->capacity) {
+      partial->capacity = 2 * partial->capacity + 16;
+      partial->rows = realloc(partial->rows, partial->capacity * sizeof(Row));
+    }
+    partial->rows[partial->num_rows++] = *row;
+  }
+}
+
+// folds the finished ranges next in key order into the result and hands
+// their rows to the callback, stopping at the first one still scanned.
+// only the calling thread of the scan merges, so the callback never runs
+// on a worker. called and returns with scan->lock held
+void parallel_scan_merge(ParallelScan *scan) {
+  while (scan->next_merge < scan->num_ranges &&
+         scan->done[scan->next_merge]) {
+    ScanPartial *partial = &scan->partials[scan->next_merge];
+    pthread_mutex_unlock(&scan->lock);
+    ScanPartial *result = scan->result;
+    if (partial->count > 0) {
+      if (result->count == 0) {
+        result->min_id = partial->min_id;
+      }
+      result->max_id = partial->max_id;
+      result->count += partial->count;
+    }
+    for (uint32_t i = 0; i < partial->num_rows; i++) {
+      scan->callback(&partial->rows[i], scan->argument);
+    }
+    free(partial->rows);
+    partial->rows = NULL;
+    pthread_mutex_lock(&scan->lock);
+    scan->next_merge += 1;
+    pthread_cond_broadcast(&scan->merged);
+  }
+}
+
+// takes ranges one at a time and scans them until none are left. a
+// thread that may not take the next range yet waits for a merge, the
+// merging thread merges what is ready instead
+void parallel_scan_ranges(ParallelScan *scan, bool merging) {
+  pthread_mutex_lock(&scan->lock);
+  while (scan->next_range < scan->num_ranges) {
+    if (scan->next_range >= scan->next_merge + scan->window) {
+      if (merging && scan->done[scan->next_merge]) {
+        parallel_scan_merge(scan);
+      } else {
+        pthread_cond_wait(&scan->merged, &scan->lock);
+      }
+      continue;
+    }
+    uint32_t range = scan->next_range++;
+    pthread_mutex_unlock(&scan->lock);
+    uint32_t end =
+        range + 1 < scan->num_ranges ? scan->starts[range + 1] - 1 : scan->end;
+    table_scan(scan->table, scan->starts[range], end, parallel_scan_row,
+               &scan->partials[range]);
+    pthread_mutex_lock(&scan->lock);
+    scan->done[range] = true;
+    pthread_cond_broadcast(&scan->merged);
+    if (merging) {
+      parallel_scan_merge(scan);
+    }
+  }
+  pthread_mutex_unlock(&scan->lock);
+}
+
+void *parallel_scan_worker(void *argument) {
+  parallel_scan_ranges(argument, false);
+  return NULL;
+}
+
+// scans the rows with ids in [start, end] on table->scan_threads threads.
+// only rows whose column holds value count unless it is NULL. the merged
+// count and id bounds end up in result, with keep_rows the rows are
+// handed to callback in key order as well, a range at a time as soon as
+// the ranges before it are done. every worker reads through its own
+// cursors, the same way concurrent readers do
+void table_parallel_scan(Table *table, uint32_t start, uint32_t end,
+                         StringColumn column, char *value,
+                         RowCallback callback, void *argument,
+                         ScanPartial *result) {
+  ParallelScan *scan = calloc(1, sizeof(ParallelScan));
+  scan->table = table;
+  scan->column = column;
+  scan->value = value;
+  scan->keep_rows = callback != NULL;
+  scan->end = end;
+  scan->callback = callback;
+  scan->argument = argument;
+  scan->result = result;
+  memset(result, 0, sizeof(ScanPartial));
+  pthread_mutex_init(&scan->lock, NULL);
+  pthread_cond_init(&scan->merged, NULL);
+  // a worker pins up to three pages at once, which a small buffer pool
+  // has to hold for every worker next to everyone else
+  uint32_t num_threads = table->scan_threads;
+  if (table->pager->map == NULL && num_threads > table->pager->num_frames / 4) {
+    num_threads = table->pager->num_frames / 4;
+  }
+  scan->num_ranges =
+      num_threads == 1
+          ? 1
+          : table_split_range(table, start, end,
+                              num_threads * SCAN_RANGES_PER_THREAD,
+                              scan->starts);
+  scan->starts[0] = start;
+  for (uint32_t i = 0; i < scan->num_ranges; i++) {
+    scan->partials[i].scan = scan;
+  }
+
+  if (num_threads > scan->num_ranges) {
+    num_threads = scan->num_ranges;
+  }
+  // counts take no memory, only kept rows need their ranges bounded
+  scan->window = scan->keep_rows ? 2 * num_threads : scan->num_ranges;
+  // the calling thread is one of the workers
+  pthread_t threads[MAX_SCAN_THREADS];
+  for (uint32_t i = 1; i < num_threads; i++) {
+    pthread_create(&threads[i], NULL, parallel_scan_worker, scan);
+  }
+  parallel_scan_ranges(scan, true);
+  pthread_mutex_lock(&scan->lock);
+  while (scan->next_merge < scan->num_ranges) {
+    parallel_scan_merge(scan);
+    if (scan->next_merge < scan->num_ranges) {
+      pthread_cond_wait(&scan->merged, &scan->lock);
+    }
+  }
+  pthread_mutex_unlock(&scan->lock);
+  for (uint32_t i = 1; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_cond_destroy(&scan->merged);
+  pthread_mutex_destroy(&scan->lock);
+  free(scan);
+}
+
+// this method reads from the database file where existing writes have occured
+Pager *pager_open(const char *filename, DbOptions *options) {
+  // we read the file with specific permissions
+  // we get the file descriptor for the read file
+  int fd = open(filename,
+                O_RDWR |       // read / write mode
+                    O_CREAT,   // make new file if it does not exists
+                S_IWUSR |      // write permission
+                    S_IRUSR);  // read permission
+
+  // file descriptor is -1 if opening of file has failed for some reason
+  if (fd == -1) {
+    printf("Unable to open file.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // we allocate a new pager and setup the coressponding file
+  // descriptor and length of the pager abstraction / file length
+  Pager *pager = malloc(sizeof(Pager));
+  memset(&pager->stats, 0, sizeof(Stats));
+  pthread_mutex_init(&pager->lock, NULL);
+  pthread_cond_init(&pager->loaded, NULL);
+  pager->num_loading = 0;
+  pager->map_latches = NULL;
+  pager->num_map_latch_chunks = 0;
+  pager->file_descriptor = fd;
+  pager->file_length = lseek(fd, 0, SEEK_END);
+
+  bool empty = pager->file_length == 0;
+  uint32_t page_size =
+      options->page_size != 0 ? options->page_size : DEFAULT_PAGE_SIZE;
+
+  // a compressed file is recognized by its header, so the option only
+  // matters when the file is created
+  pager->page_map = page_map_open(fd, options->compress, page_size);
+  if (options->compress && pager->page_map == NULL) {
+    printf("Db file was created without compression.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (options->use_mmap && pager->page_map != NULL) {
+    printf("The mmap pager can not read compressed db files.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // an existing file keeps the page size it was created with, which is
+  // found in its header before any other page can be read. the header of
+  // a compressed file is its logical page 0, behind the page map
+  FileHeader header;
+  if (!empty) {
+    bool header_valid;
+    if (pager->page_map != NULL) {
+      uint8_t *page = malloc(pager->page_map->page_size);
+      page_map_read(pager->page_map, fd, 0, page);
+      memcpy(&header, page, sizeof(header));
+      free(page);
+      header_valid = header.page_size == pager->page_map->page_size;
+    } else {
+      header_valid =
+          pread(fd, &header, sizeof(header), 0) == sizeof(header);
+    }
+    if (!header_valid ||
+        memcmp(header.magic, FILE_HEADER_MAGIC, sizeof(header.magic)) != 0) {
+      printf("Db file has no valid header. Corrupt file.\n");
+      exit(EXIT_FAILURE);
+    }
+    if (header.version != FILE_FORMAT_VERSION) {
+      printf("Db file format version %d is not supported.\n",
+             header.version);
+      exit(EXIT_FAILURE);
+    }
+    if (options->page_size != 0 && options->page_size != header.page_size) {
+      printf("Db file uses %d byte pages.\n", header.page_size);
+      exit(EXIT_FAILURE);
+    }
+    page_size = header.page_size;
+  }
+
+  // the limits which depend on the page size are worked out once here
+  // instead of on every access to a node
+  pager->page_size = page_size;
+  pager->leaf_node_space_for_cells = page_size - LEAF_NODE_HEADER_SIZE;
+  pager->internal_node_max_keys =
+      (page_size - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+  // a node is rebalanced once it is less than a third full, so a node
+  // that was just split or merged does not bounce straight back
+  pager->leaf_node_min_fill = pager->leaf_node_space_for_cells / 3;
+  pager->internal_node_min_keys = pager->internal_node_max_keys / 3;
+  pager->freelist_trunk_max_leaves =
+      (page_size - FREELIST_TRUNK_HEADER_SIZE) / sizeof(uint32_t);
+
+  // a new file gets its header written straight away, so the page size
+  // is known even if the first commit only made it to the log
+  if (empty) {
+    uint8_t *page = calloc(1, page_size);
+    FileHeader *new_header = (FileHeader *)page;
+    memcpy(new_header->magic, FILE_HEADER_MAGIC, sizeof(new_header->magic));
+    new_header->version = FILE_FORMAT_VERSION;
+    new_header->page_size = page_size;
+    new_header->root_page_num = 1;
+    pager_write_page(pager, 0, page);
+    pager_sync(pager);
+    free(page);
+  }
+
+  // with the log enabled, commits which did not reach the database
+  // file before a crash are replayed before anything else looks at it
+  Wal *wal = NULL;
+  if (options->wal) {
+    wal = wal_open(filename, options->group_commit, page_size,
+                   &pager->stats.sync);
+    wal_recover(wal, pager);
+  }
+
+  // we get the length of the file where database entries have been made
+  off_t file_length = lseek(fd, 0, SEEK_END);
+  pager->file_length = file_length;
+  pager->num_pages = (file_length / pager->page_size);
+
+  if (pager->page_map != NULL) {
+    pager->num_pages = pager->page_map->num_pages;
+  } else if (file_length % pager->page_size != 0) {
+    // is intended as a check to see if length of file is
+    // divisible by pager->page_size and check if the file is corrupted or not
+    printf("Db file is not a whole number of pages. Corrupt file.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pager->num_dirty = 0;
+  pager->checkpoint_pages = options->checkpoint_pages;
+  pager->checkpoint_seconds = options->checkpoint_seconds;
+  pager->last_checkpoint = time(NULL);
+  pager->wal = wal;
+  pager->txn_pages = NULL;
+  pager->txn_num_pages = 0;
+  pager->txn_capacity = 0;
+  pager->map = NULL;
+  pager->dirty_map = NULL;
+  pager->dirty_map_capacity = 0;
+
+  // compressed pages are decompressed through a buffer shared by the
+  // whole pager, so they are only read by the thread running statements
+  pager->read_ahead = NULL;
+  pager->read_ahead_pages = options->read_ahead_pages;
+  if (pager->page_map != NULL) {
+    pager->read_ahead_pages = 0;
+  } else if (!options->use_mmap &&
+             pager->read_ahead_pages > options->pool_frames / 4) {
+    pager->read_ahead_pages = options->pool_frames / 4;
+  }
+
+  // the mmap backend maps the whole file instead of using frames,
+  // address space is reserved up front so the mapping can grow in place
+  if (options->use_mmap) {
+    pager->map_capacity = MMAP_RESERVE_BYTES;
+    while (pager->map_capacity < (size_t)file_length) {
+      pager->map_capacity *= 2;
+    }
+    pager->map = mmap(NULL, pager->map_capacity, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (pager->map == MAP_FAILED) {
+      printf("Error mapping db file: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    pager->num_frames = 0;
+    pager->frames = NULL;
+    pager->buckets = NULL;
+    return pager;
+  }
+
+  // we allocate the frames of the buffer pool up front so the memory
+  // used by the pager stays bounded no matter how big the file gets
+  uint32_t num_frames = options->pool_frames;
+  pager->num_frames = num_frames;
+  pager->clock_hand = 0;
+  pager->frames = malloc(sizeof(Frame) * num_frames);
+  for (uint32_t i = 0; i < num_frames; i++) {
+    pager->frames[i].data = malloc(pager->page_size);
+    pager->frames[i].pin_count = 0;
+    pager->frames[i].in_use = false;
+    pager->frames[i].referenced = false;
+    pager->frames[i].dirty = false;
+    pager->frames[i].in_txn = false;
+    pager->frames[i].loading = false;
+    latch_init(&pager->frames[i].latch);
+  }
+
+  // the hash table has a power of two number of buckets,
+  // at least twice the number of frames to keep chains short
+  pager->num_buckets = 1;
+  while (pager->num_buckets < 2 * num_frames) {
+    pager->num_buckets *= 2;
+  }
+  pager->buckets = malloc(sizeof(uint32_t) * pager->num_buckets);
+  for (uint32_t i = 0; i < pager->num_buckets; i++) {
+    pager->buckets[i] = INVALID_FRAME;
+  }
+
+  return pager;
+}
+
+void subtree_shape(Cursor *cursor, uint32_t page_num, uint64_t depth,
+                   TreeShape *shape) {
+  Pager *pager = cursor->table->pager;
+  void *node = cursor_latch(cursor, page_num, LATCH_SHARED);
+  if (depth + 1 > shape->height) {
+    shape->height = depth + 1;
+  }
+  if (get_node_type(node) == NODE_LEAF) {
+    shape->num_leaves += 1;
+    shape->leaf_bytes_used +=
+        pager->leaf_node_space_for_cells - leaf_node_free_space(node);
+  } else {
+    shape->num_internal += 1;
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      subtree_shape(cursor, *internal_node_child(node, i), depth + 1, shape);
+    }
+  }
+  cursor_unlatch(cursor, page_num);
+}
+
+// the shape of the tree of the table. the writers keep it up to date,
+// only the first call walks the whole tree, with the writers kept out
+// so that none of them changes it between the walk and shape_known
+// being set. the walk reads every leaf, which the page counters see
+// like any other read
+void table_shape(Table *table, TreeShape *shape) {
+  if (!__atomic_load_n(&table->shape_known, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&table->write_lock);
+    if (!table->shape_known) {
+      Cursor *cursor = malloc(sizeof(Cursor));
+      cursor->table = table;
+      cursor->num_latched = 0;
+      TreeShape walked;
+      memset(&walked, 0, sizeof(TreeShape));
+      subtree_shape(cursor, table->root_page_num, 0, &walked);
+      free(cursor);
+      table->shape = walked;
+      __atomic_store_n(&table->shape_known, true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&table->write_lock);
+  }
+  shape->height = __atomic_load_n(&table->shape.height, __ATOMIC_RELAXED);
+  shape->num_leaves =
+      __atomic_load_n(&table->shape.num_leaves, __ATOMIC_RELAXED);
+  shape->num_internal =
+      __atomic_load_n(&table->shape.num_internal, __ATOMIC_RELAXED);
+  shape->leaf_bytes_used =
+      __atomic_load_n(&table->shape.leaf_bytes_used, __ATOMIC_RELAXED);
+}
+
+// json fields after the first are written with the comma in front
+void print_counter(FILE *file, char *name, uint64_t value, bool json) {
+  fprintf(file, json ? ", \"%s\": %llu" : "%s: %llu\n", name,
+          (unsigned long long)value);
+}
+
+void print_latency(FILE *file, char *name, LatencyHistogram *histogram,
+                   bool json) {
+  uint64_t mean =
+      histogram->count == 0 ? 0 : histogram->total_ns / histogram->count;
+  fprintf(file,
+          json ? ", \"%s\": {\"count\": %llu, \"mean_ns\": %llu, "
+                 "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+                 "\"max_ns\": %llu}"
+               : "%s: count %llu, mean %llu ns, p50 %llu ns, p99 %llu ns, "
+                 "p999 %llu ns, max %llu ns\n",
+          name, (unsigned long long)histogram->count,
+          (unsigned long long)mean,
+          (unsigned long long)latency_percentile(histogram, 0.5),
+          (unsigned long long)latency_percentile(histogram, 0.99),
+          (unsigned long long)latency_percentile(histogram, 0.999),
+          (unsigned long long)histogram->max_ns);
+}
+
+// writes the stats of the table as "name: value" lines, or as a single
+// line of json. the page counters and latencies cover every tree in the
+// file, the splits and the shape only the tree of the table, not those of
+// its indexes. latencies are bucketed, the percentiles are the upper
+// bounds of their buckets
+void print_stats(FILE *file, Table *table, bool json) {
+  Pager *pager = table->pager;
+  Stats stats;
+  stats_snapshot(&pager->stats, &stats);
+  TreeShape shape;
+  table_shape(table, &shape);
+  double leaf_fill = (double)shape.leaf_bytes_used /
+                     (shape.num_leaves * pager->leaf_node_space_for_cells);
+
+  if (json) {
+    fprintf(file, "{\"time\": %lld", (long long)time(NULL));
+  }
+  print_counter(file, "page_hits", stats.page_hits, json);
+  print_counter(file, "page_misses", stats.page_misses, json);
+  print_counter(file, "pages_read", stats.pages_read, json);
+  print_counter(file, "bytes_read", stats.bytes_read, json);
+  print_counter(file, "pages_written", stats.pages_written, json);
+  print_counter(file, "bytes_written", stats.bytes_written, json);
+  print_counter(file, "leaf_splits",
+                __atomic_load_n(&table->leaf_splits, __ATOMIC_RELAXED), json);
+  print_counter(file, "internal_splits",
+                __atomic_load_n(&table->internal_splits, __ATOMIC_RELAXED),
+                json);
+  print_counter(file, "tree_height", shape.height, json);
+  print_counter(file, "leaf_pages", shape.num_leaves, json);
+  print_counter(file, "internal_pages", shape.num_internal, json);
+  fprintf(file, json ? ", \"leaf_fill\": %.3f" : "leaf_fill: %.3f\n",
+          leaf_fill);
+  print_latency(file, "checkpoint_latency", &stats.checkpoint, json);
+  print_latency(file, "sync_latency", &stats.sync, json);
+  print_latency(file, "insert_latency", &stats.insert, json);
+  print_latency(file, "select_latency", &stats.select, json);
+  if (json) {
+    fprintf(file, "}\n");
+  }
+  fflush(file);
+}
+
+void *stats_dump_worker(void *argument) {
+  StatsDump *dump = argument;
+  pthread_mutex_lock(&dump->lock);
+  while (!dump->stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += dump->interval;
+    int result = 0;
+    while (!dump->stop && result != ETIMEDOUT) {
+      result = pthread_cond_timedwait(&dump->stop_requested, &dump->lock,
+                                      &deadline);
+    }
+    if (!dump->stop) {
+      pthread_mutex_unlock(&dump->lock);
+      print_stats(dump->file, dump->table, true);
+      pthread_mutex_lock(&dump->lock);
+    }
+  }
+  pthread_mutex_unlock(&dump->lock);
+  return NULL;
+}
+
+// starts appending the stats to filename every interval seconds
+StatsDump *stats_dump_start(Table *table, char *filename, uint32_t interval) {
+  StatsDump *dump = malloc(sizeof(StatsDump));
+  dump->file = fopen(filename, "a");
+  if (dump->file == NULL) {
+    printf("Unable to open stats file.\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&dump->lock, NULL);
+  pthread_cond_init(&dump->stop_requested, NULL);
+  dump->stop = false;
+  dump->interval = interval;
+  dump->table = table;
+  pthread_create(&dump->thread, NULL, stats_dump_worker, dump);
+  return dump;
+}
+
+// stops the dumps, the last one covers everything up to the close
+void stats_dump_stop(StatsDump *dump) {
+  pthread_mutex_lock(&dump->lock);
+  dump->stop = true;
+  pthread_cond_signal(&dump->stop_requested);
+  pthread_mutex_unlock(&dump->lock);
+  pthread_join(dump->thread, NULL);
+  print_stats(dump->file, dump->table, true);
+  fclose(dump->file);
+  pthread_mutex_destroy(&dump->lock);
+  pthread_cond_destroy(&dump->stop_requested);
+  free(dump);
+}
+
+// this method is used to perform processes before the program exits safely
+void db_close(Table *table) {
+  if (table->stats_dump != NULL) {
+    stats_dump_stop(table->stats_dump);
+  }
+  Pager *pager = table->pager;
+  // we flush the pages changed since the last checkpoint to the disk
+  // and after flushing the contents we free up the frame memory
+  read_ahead_stop(pager->read_ahead);
+  pager_checkpoint(pager);
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    free(pager->frames[i].data);
+    pthread_rwlock_destroy(&pager->frames[i].latch);
+  }
+  for (uint32_t i = 0; i < pager->num_map_latch_chunks; i++) {
+    if (pager->map_latches[i] != NULL) {
+      for (uint32_t j = 0; j < MAP_LATCH_CHUNK; j++) {
+        pthread_rwlock_destroy(&pager->map_latches[i][j]);
+      }
+      free(pager->map_latches[i]);
+    }
+  }
+  if (pager->map != NULL) {
+    munmap(pager->map, pager->map_capacity);
+  }
+  if (pager->page_map != NULL) {
+    free(pager->page_map->pages);
+    free(pager->page_map->free);
+    free(pager->page_map->buffer);
+    free(pager->page_map);
+  }
+
+  // after writing is complete we close the file represented
+  // by file descriptor to indicate to the OS that the file has been closed
+  int result = close(pager->file_descriptor);
+  if (result == -1) {
+    printf("Error closing db file.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // the checkpoint left the log empty, so a clean shutdown removes it
+  if (pager->wal != NULL) {
+    close(pager->wal->file_descriptor);
+    unlink(pager->wal->path);
+    free(pager->wal->path);
+    free(pager->wal->buffer);
+    free(pager->wal);
+  }
+
+  // after flushing contents to the disk we free up the buffer pool,
+  // the pager abstraction and the table object
+  free(pager->txn_pages);
+  free(pager->dirty_map);
+  free(pager->frames);
+  free(pager->buckets);
+  free(pager->map_latches);
+  pthread_mutex_destroy(&pager->lock);
+  pthread_cond_destroy(&pager->loaded);
+  free(pager);
+  pthread_mutex_destroy(&table->write_lock);
+  pthread_mutex_destroy(&table->count_lock);
+  for (uint32_t i = 0; i < NUM_STRING_COLUMNS; i++) {
+    free(table->indexes[i]);
+  }
+  free(table);
+}
+
+// the Table of the index of column, whose tree has its root at
+// root_page_num
+Table *index_open(Table *table, StringColumn column, uint32_t root_page_num) {
+  Table *index = calloc(1, sizeof(Table));
+  index->pager = table->pager;
+  index->root_page_num = root_page_num;
+  index->fill_percent = table->fill_percent;
+  index->column = column;
+  return index;
+}
+
+// fills in the options a database is opened with unless told otherwise
+void db_default_options(DbOptions *options) {
+  options->pool_frames = DEFAULT_POOL_FRAMES;
+  options->checkpoint_pages = 0;
+  options->checkpoint_seconds = 0;
+  options->wal = false;
+  options->group_commit = 1;
+  options->use_mmap = false;
+  options->fill_percent = 100;
+  options->compress = false;
+  options->page_size = 0;
+  options->read_ahead_pages = READ_AHEAD_PAGES;
+  options->stats_filename = NULL;
+  options->stats_interval = 10;
+  options->scan_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (options->scan_threads < 1) {
+    options->scan_threads = 1;
+  } else if (options->scan_threads > MAX_SCAN_THREADS) {
+    options->scan_threads = MAX_SCAN_THREADS;
+  }
+}
+
+// rejects options the engine can not work with
+void db_check_options(DbOptions *options) {
+  if (options->pool_frames < 8) {
+    printf("The buffer pool needs at least 8 frames.\n");
+    exit(EXIT_FAILURE);
+  }
+  // the kernel may write mapped pages back at any time, which would break
+  // the rule that the log reaches the disk before the pages it describes
+  if (options->use_mmap && options->wal) {
+    printf("The mmap pager can not be combined with the log.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (options->use_mmap && options->compress) {
+    printf("The mmap pager can not read compressed db files.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (options->group_commit < 1) {
+    options->group_commit = 1;
+  }
+  if (options->page_size != 0 && options->page_size != 4096 &&
+      options->page_size != 8192 && options->page_size != 16384 &&
+      options->page_size != MAX_PAGE_SIZE) {
+    printf("The page size must be 4096, 8192, 16384 or 65536.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (options->read_ahead_pages > MAX_READ_AHEAD_PAGES) {
+    printf("The read-ahead window can be at most %d pages.\n",
+           MAX_READ_AHEAD_PAGES);
+    exit(EXIT_FAILURE);
+  }
+  if (options->scan_threads < 1 || options->scan_threads > MAX_SCAN_THREADS) {
+    printf("A scan can run on 1 to %d threads.\n", MAX_SCAN_THREADS);
+    exit(EXIT_FAILURE);
+  }
+  if (options->fill_percent < 1 || options->fill_percent > 100) {
+    printf("The fill factor must be a percentage from 1 to 100.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (options->stats_interval < 1) {
+    printf("The stats interval must be at least 1 second.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void index_discard_unfinished(Table *table);
+
+// this method is used to create an empty new table
+Table *db_open(const char *filename, DbOptions *options) {
+  db_check_options(options);
+  Pager *pager = pager_open(filename, options);
+
+  key_search_init();
+  Table *table = malloc(sizeof(Table));
+  table->pager = pager;
+  table->fill_percent = options->fill_percent;
+  pthread_mutex_init(&table->write_lock, NULL);
+  table->scan_threads = options->scan_threads;
+  pthread_mutex_init(&table->count_lock, NULL);
+  table->row_count_known = false;
+  table->row_count = 0;
+  table->shape_known = false;
+  memset(&table->shape, 0, sizeof(TreeShape));
+  table->leaf_splits = 0;
+  table->internal_splits = 0;
+  table->stats_dump = NULL;
+
+  // the header page names the root of the tree and those of the indexes
+  FileHeader *header = get_page(pager, 0);
+  table->root_page_num = header->root_page_num;
+  for (uint32_t i = 0; i < NUM_STRING_COLUMNS; i++) {
+    uint32_t index_root_page_num = header->index_root_page_nums[i];
+    table->indexes[i] = index_root_page_num == 0
+                            ? NULL
+                            : index_open(table, i, index_root_page_num);
+  }
+  unpin_page(pager, 0);
+  index_discard_unfinished(table);
+
+  // create a new node from scratch and new db file
+  if (pager->num_pages <= table->root_page_num) {
+    void *root_node = get_page(pager, table->root_page_num);
+    initialize_leaf_node(root_node, pager->page_size);
+    set_node_root(root_node, true);
+    mark_page_dirty(pager, table->root_page_num);
+    unpin_page(pager, table->root_page_num);
+    pager_commit(pager);
+  }
+
+  if (options->stats_filename != NULL) {
+    table->stats_dump = stats_dump_start(table, options->stats_filename,
+                                         options->stats_interval);
+  }
+  return table;
+}
+
+// returns the largest key stored below a node. internal nodes do not
+// keep the key of their right child, so we follow the right edge of the
+// tree down to a leaf
+uint32_t get_node_max_key(Pager *pager, void *node) {
+  if (get_node_type(node) == NODE_LEAF) {
+    return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+  }
+
+  uint32_t right_child_page_num = *internal_node_right_child(node);
+  void *right_child = get_page(pager, right_child_page_num);
+  uint32_t max_key = get_node_max_key(pager, right_child);
+  unpin_page(pager, right_child_page_num);
+  return max_key;
+}
+
+// pointer to the page number of the next trunk of the freelist, 0 ends it
+uint32_t *freelist_trunk_next(void *page) {
+  return page + FREELIST_TRUNK_NEXT_OFFSET;
+}
+
+// pointer to the number of free leaf pages a trunk lists
+uint32_t *freelist_trunk_num_leaves(void *page) {
+  return page + FREELIST_TRUNK_NUM_LEAVES_OFFSET;
+}
+
+// pointer to the page number of a free leaf page listed by a trunk
+uint32_t *freelist_trunk_leaf(void *page, uint32_t leaf_num) {
+  return page + FREELIST_TRUNK_HEADER_SIZE + leaf_num * sizeof(uint32_t);
+}
+
+// hands out a page for a new node. pages on the freelist are reused
+// first, the file only grows when the freelist is empty. the page is
+// reserved when this returns, so it can be called again before the
+// caller has written anything to it
+uint32_t get_unused_page_num(Pager *pager) {
+  FileHeader *header = get_page(pager, 0);
+  uint32_t trunk_page_num = header->freelist_trunk;
+  if (trunk_page_num == 0) {
+    unpin_page(pager, 0);
+    uint32_t page_num = pager->num_pages;
+    get_page(pager, page_num);
+    unpin_page(pager, page_num);
+    return page_num;
+  }
+
+  // leaves are taken from the first trunk, and once it lists none the
+  // trunk page itself is handed out
+  uint32_t page_num;
+  void *trunk = get_page(pager, trunk_page_num);
+  uint32_t num_leaves = *freelist_trunk_num_leaves(trunk);
+  if (num_leaves > 0) {
+    page_num = *freelist_trunk_leaf(trunk, num_leaves - 1);
+    *freelist_trunk_num_leaves(trunk) = num_leaves - 1;
+    mark_page_dirty(pager, trunk_page_num);
+  } else {
+    page_num = trunk_page_num;
+    header->freelist_trunk = *freelist_trunk_next(trunk);
+  }
+  unpin_page(pager, trunk_page_num);
+
+  header->num_free_pages -= 1;
+  mark_page_dirty(pager, 0);
+  unpin_page(pager, 0);
+  return page_num;
+}
+
+// puts a page nobody points at any more on the freelist, it becomes a
+// leaf of the first trunk or, when that trunk is full, the new first
+// trunk. the page must not be pinned by the caller
+void free_page(Pager *pager, uint32_t page_num) {
+  FileHeader *header = get_page(pager, 0);
+  uint32_t trunk_page_num = header->freelist_trunk;
+  bool added = false;
+  if (trunk_page_num != 0) {
+    void *trunk = get_page(pager, trunk_page_num);
+    uint32_t num_leaves = *freelist_trunk_num_leaves(trunk);
+    if (num_leaves < pager->freelist_trunk_max_leaves) {
+      *freelist_trunk_leaf(trunk, num_leaves) = page_num;
+      *freelist_trunk_num_leaves(trunk) = num_leaves + 1;
+      mark_page_dirty(pager, trunk_page_num);
+      added = true;
+    }
+    unpin_page(pager, trunk_page_num);
+  }
+
+  if (!added) {
+    void *page = get_page(pager, page_num);
+    memset(page, 0, pager->page_size);
+    *freelist_trunk_next(page) = trunk_page_num;
+    mark_page_dirty(pager, page_num);
+    unpin_page(pager, page_num);
+    header->freelist_trunk = page_num;
+  }
+
+  header->num_free_pages += 1;
+  mark_page_dirty(pager, 0);
+  unpin_page(pager, 0);
+}
+
+// cuts the database file after its first num_pages pages. nothing may
+// be dirty past that point, the cached copies of those pages are dropped
+void pager_shrink(Pager *pager, uint32_t num_pages) {
+  // no read may still be filling a frame that is about to be dropped
+  pthread_mutex_lock(&pager->lock);
+  while (pager->num_loading > 0) {
+    pthread_cond_wait(&pager->loaded, &pager->lock);
+  }
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    if (pager->frames[i].in_use && pager->frames[i].page_num >= num_pages) {
+      pager_unlink_frame(pager, i);
+      pager->frames[i].in_use = false;
+    }
+  }
+
+  off_t file_length = (off_t)num_pages * pager->page_size;
+  if (pager->page_map != NULL) {
+    // the extents of the removed pages are released, and any free space
+    // left at the end of the file after the map is rewritten is cut off
+    PageMap *map = pager->page_map;
+    for (uint32_t i = num_pages; i < map->num_pages; i++) {
+      if (map->pages[i].length > 0) {
+        page_map_release(map, map->pages[i].offset,
+                         extent_capacity(map->pages[i].length));
+        map->pages[i].length = 0;
+      }
+    }
+    map->num_pages = num_pages;
+    page_map_sync(map, pager->file_descriptor);
+    if (map->num_free > 0) {
+      Extent *last = &map->free[map->num_free - 1];
+      if (last->offset + last->length == map->file_end) {
+        map->file_end = last->offset;
+        map->num_free -= 1;
+      }
+    }
+    file_length = map->file_end;
+  }
+
+  if (ftruncate(pager->file_descriptor, file_length) == -1) {
+    printf("Error truncating db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  pager->file_length = file_length;
+  pager->num_pages = num_pages;
+  pthread_mutex_unlock(&pager->lock);
+}
+
+// gives the free pages at the end of the file back to the os and
+// returns how many there were. the freelist is rebuilt from the free
+// pages that stay and checkpointed before the file is cut, so a crash
+// in between leaves a file that is only longer than it needs to be
+uint32_t pager_truncate(Pager *pager) {
+  FileHeader *header = get_page(pager, 0);
+  uint32_t *free_pages = malloc(sizeof(uint32_t) * header->num_free_pages);
+  uint32_t num_free = 0;
+  uint32_t trunk_page_num = header->freelist_trunk;
+  while (trunk_page_num != 0) {
+    void *trunk = get_page(pager, trunk_page_num);
+    free_pages[num_free++] = trunk_page_num;
+    for (uint32_t i = 0; i < *freelist_trunk_num_leaves(trunk); i++) {
+      free_pages[num_free++] = *freelist_trunk_leaf(trunk, i);
+    }
+    uint32_t next_trunk = *freelist_trunk_next(trunk);
+    unpin_page(pager, trunk_page_num);
+    trunk_page_num = next_trunk;
+  }
+  qsort(free_pages, num_free, sizeof(uint32_t), compare_page_nums);
+
+  // a page can be freed before it was ever written, so the freelist may
+  // name pages past the end of the file as well
+  uint32_t total_free = num_free;
+  uint32_t num_pages = pager->num_pages;
+  while (num_free > 0 && free_pages[num_free - 1] + 1 >= num_pages) {
+    if (free_pages[num_free - 1] < num_pages) {
+      num_pages = free_pages[num_free - 1];
+    }
+    num_free -= 1;
+  }
+  uint32_t num_removed = pager->num_pages - num_pages;
+  if (num_free == total_free) {
+    unpin_page(pager, 0);
+    free(free_pages);
+    return 0;
+  }
+
+  header->freelist_trunk = 0;
+  header->num_free_pages = 0;
+  mark_page_dirty(pager, 0);
+  unpin_page(pager, 0);
+  for (uint32_t i = 0; i < num_free; i++) {
+    free_page(pager, free_pages[i]);
+  }
+  free(free_pages);
+
+  pager_commit(pager);
+  pager_checkpoint(pager);
+  pager_shrink(pager, num_pages);
+  return num_removed;
+}
+
+// handles splitting the root. the root keeps its page number so the old
+// root is copied to a new page which becomes the left child, and the
+// root page is turned into an internal node with the two halves as
+// children. this is how the tree grows in height
+void create_new_root(Table *table, uint32_t right_child_page_num) {
+  Pager *pager = table->pager;
+  void *root = get_page(pager, table->root_page_num);
+  uint32_t left_child_page_num = get_unused_page_num(pager);
+  void *left_child = get_page(pager, left_child_page_num);
+
+  memcpy(left_child, root, pager->page_size);
+  set_node_root(left_child, false);
+
+  initialize_internal_node(root);
+  set_node_root(root, true);
+  *internal_node_num_keys(root) = 1;
+  *internal_node_child(root, 0) = left_child_page_num;
+  uint32_t left_child_max_key = get_node_max_key(pager, left_child);
+  *internal_node_key(root, 0) = left_child_max_key;
+  *internal_node_right_child(root) = right_child_page_num;
+
+  mark_page_dirty(pager, table->root_page_num);
+  mark_page_dirty(pager, left_child_page_num);
+  unpin_page(pager, table->root_page_num);
+  unpin_page(pager, left_child_page_num);
+  table_shape_add(&table->shape.num_internal, 1);
+  table_shape_add(&table->shape.height, 1);
+}
+
+void internal_node_split_and_insert(Cursor *cursor, uint32_t level,
+                                    uint32_t left_max, uint32_t right_page_num);
+
+// registers a new node in its parent after the node to its left was split.
+// the parent is the internal node at the given level of the cursor path.
+// the left node keeps its cell but its key becomes its new maximum, the
+// right node is placed just after it and takes over the old key (or the
+// right child slot if the left node used to be the right child)
+void internal_node_insert(Cursor *cursor, uint32_t level,
+                          uint32_t left_page_num, uint32_t left_max,
+                          uint32_t right_page_num) {
+  Pager *pager = cursor->table->pager;
+  uint32_t parent_page_num = cursor->path[level];
+  void *parent = get_page(pager, parent_page_num);
+  uint32_t num_keys = *internal_node_num_keys(parent);
+
+  if (num_keys >= pager->internal_node_max_keys) {
+    unpin_page(pager, parent_page_num);
+    internal_node_split_and_insert(cursor, level, left_max, right_page_num);
+    return;
+  }
+
+  uint32_t index = internal_node_find_child(parent, left_max);
+  // moving keys and children to make space for the new ones
+  node_insert_slot(internal_node_keys(parent), num_keys, index,
+                   INTERNAL_NODE_CHILD_SIZE);
+  *internal_node_num_keys(parent) += 1;
+  if (index == num_keys) {
+    *internal_node_right_child(parent) = right_page_num;
+  } else {
+    *internal_node_child(parent, index + 1) = right_page_num;
+  }
+  *internal_node_child(parent, index) = left_page_num;
+  *internal_node_key(parent, index) = left_max;
+
+  mark_page_dirty(pager, parent_page_num);
+  unpin_page(pager, parent_page_num);
+}
+
+// splits a full internal node while adding a new child to it.
+// the children and keys are gathered with the new child in place, the
+// lower half stays in the old node and the upper half moves to a new node.
+// the key between the halves becomes the key of the old node in the
+// parent, which may split in turn all the way up to the root
+void internal_node_split_and_insert(Cursor *cursor, uint32_t level,
+                                    uint32_t left_max,
+                                    uint32_t right_page_num) {
+  Pager *pager = cursor->table->pager;
+  stats_add(&cursor->table->internal_splits, 1);
+  table_shape_add(&cursor->table->shape.num_internal, 1);
+  uint32_t page_num = cursor->path[level];
+  void *old_node = get_page(pager, page_num);
+  uint32_t num_keys = *internal_node_num_keys(old_node);
+  uint32_t index = internal_node_find_child(old_node, left_max);
+
+  uint32_t children[pager->internal_node_max_keys + 2];
+  uint32_t keys[pager->internal_node_max_keys + 1];
+  for (uint32_t i = 0; i < num_keys; i++) {
+    children[i] = *internal_node_child(old_node, i);
+    keys[i] = *internal_node_key(old_node, i);
+  }
+  children[num_keys] = *internal_node_right_child(old_node);
+
+  memmove(&children[index + 2], &children[index + 1],
+          (num_keys - index) * sizeof(uint32_t));
+  memmove(&keys[index + 1], &keys[index],
+          (num_keys - index) * sizeof(uint32_t));
+  children[index + 1] = right_page_num;
+  keys[index] = left_max;
+  num_keys += 1;
+
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void *new_node = get_page(pager, new_page_num);
+  initialize_internal_node(new_node);
+
+  uint32_t split = num_keys / 2;
+  *internal_node_num_keys(old_node) = split;
+  for (uint32_t i = 0; i < split; i++) {
+    *internal_node_child(old_node, i) = children[i];
+    *internal_node_key(old_node, i) = keys[i];
+  }
+  *internal_node_right_child(old_node) = children[split];
+
+  *internal_node_num_keys(new_node) = num_keys - split - 1;
+  for (uint32_t i = split + 1; i < num_keys; i++) {
+    *internal_node_child(new_node, i - split - 1) = children[i];
+    *internal_node_key(new_node, i - split - 1) = keys[i];
+  }
+  *internal_node_right_child(new_node) = children[num_keys];
+
+  uint32_t separator = keys[split];
+  mark_page_dirty(pager, page_num);
+  mark_page_dirty(pager, new_page_num);
+  unpin_page(pager, page_num);
+  unpin_page(pager, new_page_num);
+
+  if (level == 0) {
+    create_new_root(cursor->table, new_page_num);
+  } else {
+    internal_node_insert(cursor, level - 1, page_num, separator,
+                         new_page_num);
+  }
+}
+
+// moves the cells of a leaf back to back at the end of the page, so
+// the space of fragmented cells joins the free space after the slots
+void leaf_node_compact(void *node, uint32_t page_size) {
+  uint8_t scratch[page_size];
+  uint32_t content_start = page_size;
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  for (uint32_t i = 0; i < num_cells; i++) {
+    void *cell = leaf_node_cell(node, i);
+    uint32_t size = leaf_node_cell_size(cell);
+    content_start -= size;
+    memcpy(scratch + content_start, cell, size);
+    *leaf_node_slot(node, i) = content_start;
+  }
+  memcpy(node + content_start, scratch + content_start,
+         page_size - content_start);
+  *leaf_node_content_start(node) = content_start;
+  *leaf_node_fragmented(node) = 0;
+}
+
+// copies a cell into a leaf at the given position of the slot directory,
+// compacting the leaf first if the free space is fragmented. returns
+// false if the leaf can not hold the cell
+bool leaf_node_insert_cell(void *node, uint32_t page_size, uint32_t cell_num,
+                           uint32_t key, void *cell, uint32_t size) {
+  if (leaf_node_free_space(node) < size + LEAF_NODE_SLOT_SIZE) {
+    return false;
+  }
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t slots_end = LEAF_NODE_HEADER_SIZE + num_cells * LEAF_NODE_SLOT_SIZE;
+  if (*leaf_node_content_start(node) - slots_end <
+      size + LEAF_NODE_SLOT_SIZE) {
+    leaf_node_compact(node, page_size);
+  }
+
+  *leaf_node_content_start(node) -= size;
+  memcpy(node + *leaf_node_content_start(node), cell, size);
+  node_insert_slot(leaf_node_keys(node), num_cells, cell_num,
+                   LEAF_NODE_OFFSET_SIZE);
+  *leaf_node_num_cells(node) += 1;
+  *leaf_node_key(node, cell_num) = key;
+  *leaf_node_slot(node, cell_num) = *leaf_node_content_start(node);
+  return true;
+}
+
+// splits a full leaf while inserting a new cell. the cells are divided
+// so both leaves hold about the same number of bytes, the upper part
+// moves to a new leaf and the parent learns about the new leaf, or a new
+// root is created if the leaf was the root. the old leaf keeps its cells
+// in place and only drops their slots, the next insert that needs the
+// space compacts it
+void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, void *cell,
+                                uint32_t cell_size) {
+  Pager *pager = cursor->table->pager;
+  stats_add(&cursor->table->leaf_splits, 1);
+  table_shape_add(&cursor->table->shape.num_leaves, 1);
+  void *old_node = get_page(pager, cursor->page_num);
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void *new_node = get_page(pager, new_page_num);
+  initialize_leaf_node(new_node, pager->page_size);
+
+  // count the cells of the left half, with the new cell at its position
+  uint32_t num_cells = *leaf_node_num_cells(old_node);
+  uint32_t total = pager->leaf_node_space_for_cells -
+                   leaf_node_free_space(old_node) + cell_size +
+                   LEAF_NODE_SLOT_SIZE;
+  uint32_t left_bytes = 0;
+  uint32_t split = 0;
+  while (split < num_cells) {
+    uint32_t size = cell_size;
+    if (split != cursor->cell_num) {
+      uint32_t old_index = split < cursor->cell_num ? split : split - 1;
+      size = leaf_node_cell_size(leaf_node_cell(old_node, old_index));
+    }
+    if (split > 0 && left_bytes + size + LEAF_NODE_SLOT_SIZE > total / 2) {
+      break;
+    }
+    left_bytes += size + LEAF_NODE_SLOT_SIZE;
+    split += 1;
+  }
+
+  uint32_t first_moved = split <= cursor->cell_num ? split : split - 1;
+  for (uint32_t i = first_moved; i < num_cells; i++) {
+    void *moved = leaf_node_cell(old_node, i);
+    uint32_t size = leaf_node_cell_size(moved);
+    leaf_node_insert_cell(new_node, pager->page_size, i - first_moved,
+                          *leaf_node_key(old_node, i), moved, size);
+    *leaf_node_fragmented(old_node) += size;
+  }
+  leaf_node_set_num_cells(old_node, first_moved);
+
+  if (cursor->cell_num < split) {
+    leaf_node_insert_cell(old_node, pager->page_size, cursor->cell_num, key,
+                          cell, cell_size);
+  } else {
+    leaf_node_insert_cell(new_node, pager->page_size,
+                          cursor->cell_num - first_moved, key, cell,
+                          cell_size);
+  }
+
+  // the new leaf sits between the old leaf and its former right sibling
+  *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+  *leaf_node_next_leaf(old_node) = new_page_num;
+
+  uint32_t left_max = get_node_max_key(pager, old_node);
+  mark_page_dirty(pager, cursor->page_num);
+  mark_page_dirty(pager, new_page_num);
+  unpin_page(pager, cursor->page_num);
+  unpin_page(pager, new_page_num);
+
+  if (cursor->depth == 0) {
+    create_new_root(cursor->table, new_page_num);
+  } else {
+    internal_node_insert(cursor, cursor->depth - 1, cursor->page_num,
+                         left_max, new_page_num);
+  }
+}
+
+// inserts a cell with the given key at the position of the cursor
+void leaf_node_insert_serialized(Cursor *cursor, uint32_t key, void *cell,
+                                 uint32_t cell_size) {
+  table_shape_add(&cursor->table->shape.leaf_bytes_used,
+                  cell_size + LEAF_NODE_SLOT_SIZE);
+  // we get the page that the cursor is pointing to
+  void *node = get_page(cursor->table->pager, cursor->page_num);
+
+  // the cell is copied next to the cells already in the leaf, if the
+  // leaf has no room left we split the cells across leaf nodes
+  if (!leaf_node_insert_cell(node, cursor->table->pager->page_size,
+                             cursor->cell_num, key, cell, cell_size)) {
+    unpin_page(cursor->table->pager, cursor->page_num);
+    leaf_node_split_and_insert(cursor, key, cell, cell_size);
+    return;
+  }
+
+  mark_page_dirty(cursor->table->pager, cursor->page_num);
+  unpin_page(cursor->table->pager, cursor->page_num);
+}
+
+// this method is used to insert a row into the database
+void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value) {
+  uint8_t cell[LEAF_NODE_MAX_CELL_SIZE];
+  serialize_row_value(value, cell);
+  leaf_node_insert_serialized(cursor, key, cell, row_value_size(value));
+}
+
+// drops the cell at the given position from the slot directory, its
+// bytes count as fragmented until the leaf is compacted
+void leaf_node_remove_cell(void *node, uint32_t cell_num) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  *leaf_node_fragmented(node) +=
+      leaf_node_cell_size(leaf_node_cell(node, cell_num));
+  node_remove_slot(leaf_node_keys(node), num_cells, cell_num,
+                   LEAF_NODE_OFFSET_SIZE);
+  *leaf_node_num_cells(node) = num_cells - 1;
+}
+
+// drops the cell the cursor points at from its leaf, node, as a write
+// that takes the cell out of the tree
+void cursor_remove_cell(Cursor *cursor, void *node) {
+  uint32_t size = leaf_node_cell_size(leaf_node_cell(node, cursor->cell_num));
+  table_shape_add(&cursor->table->shape.leaf_bytes_used,
+                  -(int64_t)(size + LEAF_NODE_SLOT_SIZE));
+  leaf_node_remove_cell(node, cursor->cell_num);
+}
+
+// the bytes a leaf spends on its cells and their slots
+uint32_t leaf_node_used_space(Pager *pager, void *node) {
+  return pager->leaf_node_space_for_cells - leaf_node_free_space(node);
+}
+
+// frees a page a write took out of the tree, after letting go of the
+// latch the cursor may hold on it. its parent no longer points at it or
+// is still latched, so no reader can get to it
+void cursor_free_page(Cursor *cursor, uint32_t page_num) {
+  cursor_unlatch(cursor, page_num);
+  free_page(cursor->table->pager, page_num);
+}
+
+// a root left with a single child hands its place over to that child,
+// the child is copied into the root page so the root keeps its page
+// number and the tree gets one level shorter
+void collapse_root(Cursor *cursor) {
+  Table *table = cursor->table;
+  Pager *pager = table->pager;
+  void *root = get_page(pager, table->root_page_num);
+  uint32_t child_page_num = *internal_node_right_child(root);
+  void *child = get_page(pager, child_page_num);
+  memcpy(root, child, pager->page_size);
+  set_node_root(root, true);
+  mark_page_dirty(pager, table->root_page_num);
+  unpin_page(pager, table->root_page_num);
+  unpin_page(pager, child_page_num);
+  cursor_free_page(cursor, child_page_num);
+  table_shape_add(&table->shape.num_internal, -1);
+  table_shape_add(&table->shape.height, -1);
+}
+
+void internal_node_rebalance(Cursor *cursor, uint32_t level, uint32_t key);
+
+// removes the child after index from the internal node at the given
+// level of the cursor path once it was merged into the child at index.
+// the merged child takes over the place and the key of the right one.
+// a root left with one child collapses and any other node left with
+// too few keys is rebalanced with a sibling
+void internal_node_remove(Cursor *cursor, uint32_t level, uint32_t index,
+                          uint32_t key) {
+  Pager *pager = cursor->table->pager;
+  uint32_t page_num = cursor->path[level];
+  void *node = get_page(pager, page_num);
+  uint32_t num_keys = *internal_node_num_keys(node);
+  *internal_node_child(node, index + 1) = *internal_node_child(node, index);
+  node_remove_slot(internal_node_keys(node), num_keys, index,
+                   INTERNAL_NODE_CHILD_SIZE);
+  *internal_node_num_keys(node) = num_keys - 1;
+  mark_page_dirty(pager, page_num);
+  unpin_page(pager, page_num);
+
+  if (level == 0) {
+    if (num_keys - 1 == 0) {
+      collapse_root(cursor);
+    }
+  } else if (num_keys - 1 < pager->internal_node_min_keys) {
+    internal_node_rebalance(cursor, level, key);
+  }
+}
+
+// picks the sibling an underfull node at the given level of the path is
+// rebalanced with. the pair is returned as the index of its left node in
+// the parent, the right sibling is used unless the node is the last child
+uint32_t node_sibling_index(Cursor *cursor, uint32_t level, uint32_t key) {
+  Pager *pager = cursor->table->pager;
+  void *parent = get_page(pager, cursor->path[level - 1]);
+  uint32_t index = internal_node_find_child(parent, key);
+  if (index == *internal_node_num_keys(parent)) {
+    index -= 1;
+  }
+  unpin_page(pager, cursor->path[level - 1]);
+  return index;
+}
+
+// rebalances an underfull leaf with a sibling. when both fit in one
+// leaf the right one is merged into the left one and freed, keeping the
+// leaf chain intact, otherwise cells move over until both hold about
+// the same number of bytes and the key between them is updated
+void leaf_node_rebalance(Cursor *cursor, uint32_t key) {
+  Pager *pager = cursor->table->pager;
+  uint32_t parent_page_num = cursor->path[cursor->depth - 1];
+  uint32_t index = node_sibling_index(cursor, cursor->depth, key);
+  void *parent = get_page(pager, parent_page_num);
+  uint32_t left_page_num = *internal_node_child(parent, index);
+  uint32_t right_page_num = *internal_node_child(parent, index + 1);
+  uint32_t sibling_page_num =
+      left_page_num == cursor->page_num ? right_page_num : left_page_num;
+  cursor_latch(cursor, sibling_page_num, LATCH_EXCLUSIVE);
+  void *left = get_page(pager, left_page_num);
+  void *right = get_page(pager, right_page_num);
+  uint32_t left_used = leaf_node_used_space(pager, left);
+  uint32_t right_used = leaf_node_used_space(pager, right);
+
+  if (left_used + right_used <= pager->leaf_node_space_for_cells) {
+    uint32_t num_left = *leaf_node_num_cells(left);
+    for (uint32_t i = 0; i < *leaf_node_num_cells(right); i++) {
+      void *cell = leaf_node_cell(right, i);
+      leaf_node_insert_cell(left, pager->page_size, num_left + i,
+                            *leaf_node_key(right, i), cell,
+                            leaf_node_cell_size(cell));
+    }
+    *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+    mark_page_dirty(pager, left_page_num);
+    unpin_page(pager, left_page_num);
+    unpin_page(pager, right_page_num);
+    unpin_page(pager, parent_page_num);
+    cursor_unlatch(cursor, sibling_page_num);
+    cursor_free_page(cursor, right_page_num);
+    table_shape_add(&cursor->table->shape.num_leaves, -1);
+    internal_node_remove(cursor, cursor->depth - 1, index, key);
+    return;
+  }
+
+  while (left_used < right_used) {
+    void *cell = leaf_node_cell(right, 0);
+    uint32_t size = leaf_node_cell_size(cell) + LEAF_NODE_SLOT_SIZE;
+    if (left_used + size > right_used - size) {
+      break;
+    }
+    leaf_node_insert_cell(left, pager->page_size, *leaf_node_num_cells(left),
+                          *leaf_node_key(right, 0), cell,
+                          size - LEAF_NODE_SLOT_SIZE);
+    leaf_node_remove_cell(right, 0);
+    left_used += size;
+    right_used -= size;
+  }
+  while (right_used < left_used) {
+    uint32_t last = *leaf_node_num_cells(left) - 1;
+    void *cell = leaf_node_cell(left, last);
+    uint32_t size = leaf_node_cell_size(cell) + LEAF_NODE_SLOT_SIZE;
+    if (right_used + size > left_used - size) {
+      break;
+    }
+    leaf_node_insert_cell(right, pager->page_size, 0,
+                          *leaf_node_key(left, last), cell,
+                          size - LEAF_NODE_SLOT_SIZE);
+    leaf_node_remove_cell(left, last);
+    left_used -= size;
+    right_used += size;
+  }
+
+  *internal_node_key(parent, index) =
+      *leaf_node_key(left, *leaf_node_num_cells(left) - 1);
+  mark_page_dirty(pager, left_page_num);
+  mark_page_dirty(pager, right_page_num);
+  mark_page_dirty(pager, parent_page_num);
+  unpin_page(pager, left_page_num);
+  unpin_page(pager, right_page_num);
+  unpin_page(pager, parent_page_num);
+  cursor_unlatch(cursor, sibling_page_num);
+}
+
+// rebalances an underfull internal node at the given level of the path
+// with a sibling. the children and keys of both are gathered with the
+// key between them from the parent, then either all of them go to the
+// left node and the right one is freed, or they are split evenly and
+// the key in the middle moves up to the parent
+void internal_node_rebalance(Cursor *cursor, uint32_t level, uint32_t key) {
+  Pager *pager = cursor->table->pager;
+  uint32_t parent_page_num = cursor->path[level - 1];
+  uint32_t index = node_sibling_index(cursor, level, key);
+  void *parent = get_page(pager, parent_page_num);
+  uint32_t left_page_num = *internal_node_child(parent, index);
+  uint32_t right_page_num = *internal_node_child(parent, index + 1);
+  uint32_t sibling_page_num = left_page_num == cursor->path[level]
+                                  ? right_page_num
+                                  : left_page_num;
+  cursor_latch(cursor, sibling_page_num, LATCH_EXCLUSIVE);
+  void *left = get_page(pager, left_page_num);
+  void *right = get_page(pager, right_page_num);
+
+  uint32_t children[2 * pager->internal_node_max_keys + 2];
+  uint32_t keys[2 * pager->internal_node_max_keys + 1];
+  uint32_t num_keys = 0;
+  uint32_t num_left = *internal_node_num_keys(left);
+  for (uint32_t i = 0; i < num_left; i++) {
+    children[num_keys] = *internal_node_child(left, i);
+    keys[num_keys++] = *internal_node_key(left, i);
+  }
+  children[num_keys] = *internal_node_right_child(left);
+  keys[num_keys++] = *internal_node_key(parent, index);
+  uint32_t num_right = *internal_node_num_keys(right);
+  for (uint32_t i = 0; i < num_right; i++) {
+    children[num_keys] = *internal_node_child(right, i);
+    keys[num_keys++] = *internal_node_key(right, i);
+  }
+  children[num_keys] = *internal_node_right_child(right);
+
+  bool merge = num_keys <= pager->internal_node_max_keys;
+  uint32_t split = merge ? num_keys : num_keys / 2;
+  *internal_node_num_keys(left) = split;
+  for (uint32_t i = 0; i < split; i++) {
+    *internal_node_child(left, i) = children[i];
+    *internal_node_key(left, i) = keys[i];
+  }
+  *internal_node_right_child(left) = children[split];
+
+  if (!merge) {
+    *internal_node_num_keys(right) = num_keys - split - 1;
+    for (uint32_t i = split + 1; i < num_keys; i++) {
+      *internal_node_child(right, i - split - 1) = children[i];
+      *internal_node_key(right, i - split - 1) = keys[i];
+    }
+    *internal_node_right_child(right) = children[num_keys];
+    *internal_node_key(parent, index) = keys[split];
+    mark_page_dirty(pager, right_page_num);
+    mark_page_dirty(pager, parent_page_num);
+  }
+  mark_page_dirty(pager, left_page_num);
+  unpin_page(pager, left_page_num);
+  unpin_page(pager, right_page_num);
+  unpin_page(pager, parent_page_num);
+  cursor_unlatch(cursor, sibling_page_num);
+
+  if (merge) {
+    cursor_free_page(cursor, right_page_num);
+    table_shape_add(&cursor->table->shape.num_internal, -1);
+    internal_node_remove(cursor, level - 1, index, key);
+  }
+}
+
+// an index maps the values of a string column to the ids of the rows
+// holding them. its tree is keyed by slots: a value belongs to the slot
+// its hash names, and if another value took that slot already, to the
+// first slot after it which is free. the slot is the key of the cell and
+// the cell looks like a row cell, the value and then the ids as the
+// second string, so an entry has room for up to index_capacity ids and a
+// value with more
+// rows takes further slots. an entry whose ids are all gone stays behind
+// as a tombstone, which keeps the slots after it reachable and is taken
+// by the next value that passes by. tombstones at the end of a run keep
+// nothing reachable and are dropped
+#define INDEX_MAX_IDS (UINT8_MAX / sizeof(uint32_t))
+
+typedef struct {
+  uint32_t slot;
+  char value[COLUMN_EMAIL_SIZE + 1];
+  uint32_t num_ids;
+  uint32_t ids[INDEX_MAX_IDS];
+} IndexEntry;
+
+// how many ids fit into an entry next to a value of the given length
+uint32_t index_capacity(uint32_t value_length) {
+  uint32_t space = COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE - value_length;
+  if (space > UINT8_MAX) {
+    space = UINT8_MAX;
+  }
+  return space / sizeof(uint32_t);
+}
+
+// FNV-1a over the value, the slot a value tries first
+uint32_t index_hash(char *value) {
+  uint32_t hash = 2166136261u;
+  for (; *value != '\0'; value++) {
+    hash ^= (uint8_t)*value;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// reads the entry of a cell, the caller knows its slot
+void index_entry_read(void *cell, IndexEntry *entry) {
+  uint8_t value_length = *(uint8_t *)cell;
+  memcpy(entry->value, cell + LEAF_NODE_LENGTH_SIZE, value_length);
+  entry->value[value_length] = '\0';
+  cell += LEAF_NODE_LENGTH_SIZE + value_length;
+  uint8_t ids_length = *(uint8_t *)cell;
+  entry->num_ids = ids_length / sizeof(uint32_t);
+  memcpy(entry->ids, cell + LEAF_NODE_LENGTH_SIZE, ids_length);
+}
+
+// serializes an entry into a cell and returns its size
+uint32_t index_entry_write(IndexEntry *entry, void *cell) {
+  uint8_t value_length = strlen(entry->value);
+  uint8_t ids_length = entry->num_ids * sizeof(uint32_t);
+  *(uint8_t *)cell = value_length;
+  memcpy(cell + LEAF_NODE_LENGTH_SIZE, entry->value, value_length);
+  cell += LEAF_NODE_LENGTH_SIZE + value_length;
+  *(uint8_t *)cell = ids_length;
+  memcpy(cell + LEAF_NODE_LENGTH_SIZE, entry->ids, ids_length);
+  return 2 * LEAF_NODE_LENGTH_SIZE + value_length + ids_length;
+}
+
+typedef bool (*IndexVisitor)(IndexEntry *entry, void *argument);
+
+// hands the entries of the slots from slot on to visitor, up to the first
+// free slot, whose number is returned. the visitor returns false to stop
+// early, the slot of the entry it stopped at is returned then. one leaf
+// is latched at a time, the run of slots may go on in the next leaf and
+// wraps around after the last slot
+uint32_t index_walk(Table *index, uint32_t slot, IndexVisitor visitor,
+                    void *argument) {
+  Pager *pager = index->pager;
+  IndexEntry entry;
+  while (true) {
+    Cursor *cursor = table_seek(index, slot, DESCEND_READ);
+    void *node = get_page(pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t cell_num = cursor->cell_num;
+    bool stopped = false;
+    for (; cell_num < num_cells && *leaf_node_key(node, cell_num) == slot;
+         cell_num++) {
+      index_entry_read(leaf_node_cell(node, cell_num), &entry);
+      entry.slot = slot;
+      if (!visitor(&entry, argument)) {
+        stopped = true;
+        break;
+      }
+      slot += 1;
+    }
+    unpin_page(pager, cursor->page_num);
+    // the run goes on only if it took the leaf up to its end. the last
+    // leaf ends right before slot 0 too, which a walk starting at a free
+    // slot 0 must not take as a run wrapping around
+    bool next_leaf = !stopped && cell_num > cursor->cell_num &&
+                     cell_num == num_cells &&
+                     cursor->leaf_max_key == slot - 1;
+    cursor_close(cursor);
+    if (!next_leaf) {
+      return slot;
+    }
+  }
+}
+
+// writes an entry to its slot, over the entry there before if there is
+// one. the leaf is latched on its own unless the entry does not fit
+void index_write_entry(Table *index, IndexEntry *entry) {
+  Pager *pager = index->pager;
+  uint8_t cell[LEAF_NODE_MAX_CELL_SIZE];
+  uint32_t size = index_entry_write(entry, cell);
+
+  Cursor *cursor = table_seek(index, entry->slot, DESCEND_WRITE_LEAF);
+  void *node = get_page(pager, cursor->page_num);
+  bool exists = cursor->cell_num < *leaf_node_num_cells(node) &&
+                *leaf_node_key(node, cursor->cell_num) == entry->slot;
+  uint32_t available = leaf_node_free_space(node);
+  if (exists) {
+    available += LEAF_NODE_SLOT_SIZE +
+                 leaf_node_cell_size(leaf_node_cell(node, cursor->cell_num));
+  }
+  // a split changes the parents too, the path is latched for it
+  if (available < size + LEAF_NODE_SLOT_SIZE) {
+    unpin_page(pager, cursor->page_num);
+    cursor_close(cursor);
+    cursor = table_seek(index, entry->slot, DESCEND_INSERT);
+    node = get_page(pager, cursor->page_num);
+  }
+
+  if (exists) {
+    cursor_remove_cell(cursor, node);
+    mark_page_dirty(pager, cursor->page_num);
+  }
+  unpin_page(pager, cursor->page_num);
+  leaf_node_insert_serialized(cursor, entry->slot, cell, size);
+  cursor_close(cursor);
+}
+
+// what a walk is looking for and what it found on the way
+typedef struct {
+  char *value;
+  uint32_t id;
+  bool found;
+  IndexEntry entry;
+  bool found_tombstone;
+  uint32_t tombstone;
+} IndexSearch;
+
+// stops at an entry of the value with room for one more id and notes the
+// first tombstone on the way
+bool index_find_room(IndexEntry *entry, void *argument) {
+  IndexSearch *search = argument;
+  if (entry->num_ids == 0) {
+    if (!search->found_tombstone) {
+      search->found_tombstone = true;
+      search->tombstone = entry->slot;
+    }
+    return true;
+  }
+  if (strcmp(entry->value, search->value) == 0 &&
+      entry->num_ids < index_capacity(strlen(entry->value))) {
+    search->found = true;
+    search->entry = *entry;
+    return false;
+  }
+  return true;
+}
+
+// stops at the entry of the value which holds the id
+bool index_find_id(IndexEntry *entry, void *argument) {
+  IndexSearch *search = argument;
+  if (entry->num_ids == 0 || strcmp(entry->value, search->value) != 0) {
+    return true;
+  }
+  for (uint32_t i = 0; i < entry->num_ids; i++) {
+    if (entry->ids[i] == search->id) {
+      search->found = true;
+      search->entry = *entry;
+      return false;
+    }
+  }
+  return true;
+}
+
+// stops at the first entry, which ends up in the search
+bool index_find_first(IndexEntry *entry, void *argument) {
+  IndexSearch *search = argument;
+  search->found = true;
+  search->entry = *entry;
+  return false;
 }
 
-// this method is used to create an empty new table
-Table *db_open(const char *filename) {
-  Pager *pager = pager_open(filename);
+// reads the entry in slot into search, search->found tells whether the
+// slot holds one
+void index_read_slot(Table *index, uint32_t slot, IndexSearch *search) {
+  search->found = false;
+  index_walk(index, slot, index_find_first, search);
+}
 
-  Table *table = malloc(sizeof(Table));
-  table->pager = pager;
-  table->root_page_num = 0;
+// takes the entry out of its slot, which becomes free. a leaf left less
+// than a third full is rebalanced like after a delete from a table
+void index_free_slot(Table *index, uint32_t slot) {
+  Pager *pager = index->pager;
+  Cursor *cursor = table_seek(index, slot, DESCEND_WRITE_LEAF);
+  void *node = get_page(pager, cursor->page_num);
+  cursor_remove_cell(cursor, node);
+  bool underfull =
+      cursor->depth > 0 &&
+      leaf_node_used_space(pager, node) < pager->leaf_node_min_fill;
+  mark_page_dirty(pager, cursor->page_num);
+  unpin_page(pager, cursor->page_num);
+  cursor_close(cursor);
+  if (underfull) {
+    cursor = table_seek(index, slot, DESCEND_DELETE);
+    leaf_node_rebalance(cursor, slot);
+    cursor_close(cursor);
+  }
+}
 
-  // create a new node from scratch and new db file
-  if (pager->num_pages == 0) {
-    void *root_node = get_page(pager, 0);
-    initialize_leaf_node(root_node);
-    set_node_root(root_node, true);
+// adds the id of a row holding value. it goes to an entry of the value
+// with room left, or else to a new entry in the first tombstone or free
+// slot of the run. the entry the value last got an id in is tried first,
+// so many rows sharing a value do not walk their whole run every time.
+// when that entry is full the walk starts there, the slots before it
+// stay taken as long as it holds ids
+void index_insert(Table *index, char *value, uint32_t id) {
+  IndexSearch search = {.value = value, .id = id};
+  uint32_t hash = index_hash(value);
+  uint32_t *hint = &index->room_hints[hash % INDEX_ROOM_HINTS];
+  uint32_t start = hash;
+  index_read_slot(index, *hint, &search);
+  bool same_value = search.found && search.entry.num_ids > 0 &&
+                    strcmp(search.entry.value, value) == 0;
+  search.found = same_value && search.entry.num_ids <
+                                   index_capacity(strlen(value));
+  uint32_t free_slot = 0;
+  if (!search.found) {
+    start = same_value ? *hint : hash;
+    free_slot = index_walk(index, start, index_find_room, &search);
+  }
+  if (!search.found) {
+    search.entry.slot = search.found_tombstone ? search.tombstone : free_slot;
+    strcpy(search.entry.value, value);
+    search.entry.num_ids = 0;
   }
+  search.entry.ids[search.entry.num_ids++] = id;
+  index_write_entry(index, &search.entry);
+  *hint = search.entry.slot;
+}
 
-  return table;
+// takes the id of a row holding value out of the index, an entry left
+// without ids becomes a tombstone. if the slot after it is free the
+// entry ends its run, so it is dropped instead, along with the
+// tombstones right before it. a reader walking the run meanwhile stops
+// early at a freed slot, past which there is nothing left to find
+void index_remove(Table *index, char *value, uint32_t id) {
+  IndexSearch search = {.value = value, .id = id};
+  index_walk(index, index_hash(value), index_find_id, &search);
+  if (!search.found) {
+    return;
+  }
+  IndexEntry *entry = &search.entry;
+  for (uint32_t i = 0; i < entry->num_ids; i++) {
+    if (entry->ids[i] == id) {
+      entry->ids[i] = entry->ids[--entry->num_ids];
+      break;
+    }
+  }
+  if (entry->num_ids > 0) {
+    index_write_entry(index, entry);
+    return;
+  }
+  IndexSearch neighbor;
+  uint32_t slot = entry->slot;
+  index_read_slot(index, slot + 1, &neighbor);
+  if (neighbor.found) {
+    entry->value[0] = '\0';
+    index_write_entry(index, entry);
+    return;
+  }
+  do {
+    index_free_slot(index, slot);
+    slot -= 1;
+    index_read_slot(index, slot, &neighbor);
+  } while (neighbor.found && neighbor.entry.num_ids == 0);
 }
 
-// TODO: add notes
-uint32_t *internal_node_right_child(void *node) {
-  return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+// the ids a lookup has collected so far
+typedef struct {
+  char *value;
+  uint32_t *ids;
+  uint32_t num_ids;
+  uint32_t capacity;
+} IndexLookup;
+
+bool index_collect_ids(IndexEntry *entry, void *argument) {
+  IndexLookup *lookup = argument;
+  if (entry->num_ids == 0 || strcmp(entry->value, lookup->value) != 0) {
+    return true;
+  }
+  if (lookup->num_ids + entry->num_ids > lookup->capacity) {
+    lookup->capacity = 2 * lookup->capacity + entry->num_ids;
+    lookup->ids = realloc(lookup->ids, lookup->capacity * sizeof(uint32_t));
+  }
+  memcpy(lookup->ids + lookup->num_ids, entry->ids,
+         entry->num_ids * sizeof(uint32_t));
+  lookup->num_ids += entry->num_ids;
+  return true;
 }
 
-// TODO: add notes
-uint32_t *internal_node_cell(void *node, uint32_t cell_num) {
-  return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+// looks up the ids of the rows holding value and returns how many there
+// are. the ids are sorted and the caller frees them. only the leaves of
+// the slots from the hash of the value to the end of its run are read
+uint32_t index_lookup(Table *index, char *value, uint32_t **ids) {
+  IndexLookup lookup = {.value = value};
+  index_walk(index, index_hash(value), index_collect_ids, &lookup);
+  qsort(lookup.ids, lookup.num_ids, sizeof(uint32_t), compare_ids);
+  *ids = lookup.ids;
+  return lookup.num_ids;
 }
 
-// TODO: add notes
-uint32_t *internal_node_child(void *node, uint32_t child_num) {
-  uint32_t num_keys = *internal_node_num_keys(node);
-  if (child_num > num_keys) {
-    printf("Tried to access child_num %d > num_keys %d\n", child_num, num_keys);
-    exit(EXIT_FAILURE);
-  } else if (child_num == num_keys) {
-    return internal_node_right_child(node);
-  } else {
-    return internal_node_cell(node, child_num);
+// brings the indexes of a table up to date after a write replaced
+// old_row with new_row. an insert has no old row and a delete no new
+// one. called by the writers with the write lock held, after they let go
+// of the latches of the table
+void table_index_row(Table *table, Row *old_row, Row *new_row) {
+  for (uint32_t i = 0; i < NUM_STRING_COLUMNS; i++) {
+    Table *index = table->indexes[i];
+    if (index == NULL ||
+        (old_row != NULL && new_row != NULL &&
+         strcmp(row_column(old_row, i), row_column(new_row, i)) == 0)) {
+      continue;
+    }
+    if (old_row != NULL) {
+      index_remove(index, row_column(old_row, i), old_row->id);
+    }
+    if (new_row != NULL) {
+      index_insert(index, row_column(new_row, i), new_row->id);
+    }
   }
 }
 
-// TODO: add notes
-uint32_t *internal_node_key(void *node, uint32_t key_num) {
-  return internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+// adds a row the table holds already to an index that is being filled,
+// which is committed in pieces like a load
+void index_scanned_row(Row *row, void *argument) {
+  Table *index = argument;
+  index_insert(index, row_column(row, index->column), row->id);
+  pager_commit_if_large(index->pager);
 }
 
-// TODO: add notes
-uint32_t get_node_max_key(void *node) {
-  switch (get_node_type(node)) {
-    case NODE_INTERNAL:
-      return *internal_node_key(node, *internal_node_num_keys(node) - 1);
-    case NODE_LEAF:
-      return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+// removes the row with the given id. a leaf left less than a third full
+// is rebalanced with a sibling, which may ripple up to the root
+ExecuteResult table_delete(Table *table, uint32_t key) {
+  Pager *pager = table->pager;
+  table_write_begin(table);
+  Cursor *cursor = table_seek(table, key, DESCEND_WRITE_LEAF);
+  void *node = get_page(pager, cursor->page_num);
+  if (cursor->cell_num >= *leaf_node_num_cells(node) ||
+      *leaf_node_key(node, cursor->cell_num) != key) {
+    unpin_page(pager, cursor->page_num);
+    cursor_close(cursor);
+    table_write_end(table);
+    return EXECUTE_KEY_NOT_FOUND;
+  }
+
+  Row row;
+  leaf_node_read_row(node, cursor->cell_num, &row);
+  cursor_remove_cell(cursor, node);
+  table_count_rows(table, -1);
+  bool underfull =
+      cursor->depth > 0 &&
+      leaf_node_used_space(pager, node) < pager->leaf_node_min_fill;
+  mark_page_dirty(pager, cursor->page_num);
+  unpin_page(pager, cursor->page_num);
+  cursor_close(cursor);
+
+  // the rebalance changes the parent and a sibling as well, so the path
+  // is latched by a second descent. readers may see the underfull leaf
+  // in between, it is only emptier than it should be
+  if (underfull) {
+    cursor = table_seek(table, key, DESCEND_DELETE);
+    leaf_node_rebalance(cursor, key);
+    cursor_close(cursor);
   }
+
+  table_index_row(table, &row, NULL);
+  table_write_end(table);
+  return EXECUTE_SUCCESS;
 }
 
-// TODO: add notes
-uint32_t get_unused_page_num(Pager *pager) { return pager->num_pages; }
+// replaces the row with the same id. a row that is not longer than the
+// old one is written over the old cell through leaf_node_value and the
+// tree is left alone, a longer row is inserted as a new cell, which
+// splits the leaf if it does not fit any more
+ExecuteResult table_update(Table *table, Row *row) {
+  Pager *pager = table->pager;
+  table_write_begin(table);
+  Cursor *cursor = table_seek(table, row->id, DESCEND_WRITE_LEAF);
+  void *node = get_page(pager, cursor->page_num);
+  if (cursor->cell_num >= *leaf_node_num_cells(node) ||
+      *leaf_node_key(node, cursor->cell_num) != row->id) {
+    unpin_page(pager, cursor->page_num);
+    cursor_close(cursor);
+    table_write_end(table);
+    return EXECUTE_KEY_NOT_FOUND;
+  }
 
-// TODO: add notes
-void create_new_root(Table *table, uint32_t right_child_page_num) {
-  void *root = get_page(table->pager, table->root_page_num);
-  void *right_child = get_page(table->pager, right_child_page_num);
-  uint32_t left_child_page_num = get_unused_page_num(table->pager);
-  void *left_child = get_page(table->pager, left_child_page_num);
+  Row old_row;
+  leaf_node_read_row(node, cursor->cell_num, &old_row);
+  uint32_t old_size =
+      leaf_node_cell_size(leaf_node_value(node, cursor->cell_num));
+  uint32_t new_size = row_value_size(row);
+  // a split changes the parents too, the path is latched for it
+  if (new_size > old_size &&
+      leaf_node_free_space(node) + old_size < new_size) {
+    unpin_page(pager, cursor->page_num);
+    cursor_close(cursor);
+    cursor = table_seek(table, row->id, DESCEND_INSERT);
+    node = get_page(pager, cursor->page_num);
+  }
 
-  memcpy(left_child, root, PAGE_SIZE);
-  set_node_root(left_child, false);
+  void *value = leaf_node_value(node, cursor->cell_num);
+  if (new_size <= old_size) {
+    serialize_row_value(row, value);
+    *leaf_node_fragmented(node) += old_size - new_size;
+    table_shape_add(&table->shape.leaf_bytes_used,
+                    (int64_t)new_size - old_size);
+    mark_page_dirty(pager, cursor->page_num);
+    unpin_page(pager, cursor->page_num);
+  } else {
+    cursor_remove_cell(cursor, node);
+    mark_page_dirty(pager, cursor->page_num);
+    unpin_page(pager, cursor->page_num);
+    leaf_node_insert(cursor, row->id, row);
+  }
 
-  initialize_internal_node(root);
-  set_node_root(root, true);
-  *internal_node_num_keys(root) = 1;
-  *internal_node_child(root, 0) = get_node_max_key(left_child);
-  uint32_t left_child_max_key = get_node_max_key(left_child);
-  *internal_node_key(root, 0) = left_child_max_key;
-  *internal_node_right_child(root) = right_child_page_num;
+  cursor_close(cursor);
+  table_index_row(table, &old_row, row);
+  table_write_end(table);
+  return EXECUTE_SUCCESS;
 }
 
-// TODO: add notes
-bool is_node_root(void *node) {
-  uint8_t value = *((uint8_t *)(node + IS_ROOT_OFFSET));
-  return (bool)value;
+// inserts a single row, the caller runs the write. the leaf is latched
+// on its own, unless it is full and has to be split, which changes the
+// parents as well and is done under the latches of a second descent
+ExecuteResult table_insert_row(Table *table, Row *row) {
+  Pager *pager = table->pager;
+  // we find the leaf and the position where the key belongs
+  Cursor *cursor = table_seek(table, row->id, DESCEND_WRITE_LEAF);
+  void *node = get_page(pager, cursor->page_num);
+  if (cursor->cell_num < *leaf_node_num_cells(node) &&
+      *leaf_node_key(node, cursor->cell_num) == row->id) {
+    unpin_page(pager, cursor->page_num);
+    cursor_close(cursor);
+    return EXECUTE_DUPLICATE_KEY;
+  }
+  bool fits = leaf_node_free_space(node) >=
+              row_value_size(row) + LEAF_NODE_SLOT_SIZE;
+  unpin_page(pager, cursor->page_num);
+  if (!fits) {
+    cursor_close(cursor);
+    cursor = table_seek(table, row->id, DESCEND_INSERT);
+  }
+
+  leaf_node_insert(cursor, row->id, row);
+  cursor_close(cursor);
+  table_count_rows(table, 1);
+  table_index_row(table, NULL, row);
+  return EXECUTE_SUCCESS;
 }
 
-// TODO: add notes
-void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value) {
-  void *old_node = get_page(cursor->table->pager, cursor->page_num);
-  uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-  void *new_node = get_page(cursor->table->pager, new_page_num);
-  initialize_leaf_node(new_node);
+ExecuteResult table_insert(Table *table, Row *row) {
+  table_write_begin(table);
+  ExecuteResult result = table_insert_row(table, row);
+  table_write_end(table);
+  return result;
+}
 
-  for (uint32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-    void *destination_node;
-    if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-      destination_node = new_node;
-    } else {
-      destination_node = old_node;
-    }
+// creates the index of a column and fills it with the rows in the table.
+// its tree gets a root leaf of its own, which the header page names. the
+// readers only learn about the index once it is complete
+ExecuteResult table_create_index(Table *table, StringColumn column) {
+  Pager *pager = table->pager;
+  table_write_begin(table);
+  if (table->indexes[column] != NULL) {
+    table_write_end(table);
+    return EXECUTE_INDEX_EXISTS;
+  }
 
-    uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-    void *destination = leaf_node_cell(destination_node, index_within_node);
+  uint32_t root_page_num = get_unused_page_num(pager);
+  void *root = get_page(pager, root_page_num);
+  initialize_leaf_node(root, pager->page_size);
+  set_node_root(root, true);
+  mark_page_dirty(pager, root_page_num);
+  unpin_page(pager, root_page_num);
+
+  // the build is committed in pieces, the header names the index from
+  // the first piece on so that a crash in between does not lose its
+  // pages. the bit tells the next open to throw them away
+  FileHeader *header = get_page(pager, 0);
+  header->index_root_page_nums[column] = root_page_num;
+  header->building_indexes |= 1 << column;
+  mark_page_dirty(pager, 0);
+  unpin_page(pager, 0);
+
+  Table *index = index_open(table, column, root_page_num);
+  table_scan(table, 0, UINT32_MAX, index_scanned_row, index);
+  header = get_page(pager, 0);
+  header->building_indexes &= ~(1 << column);
+  mark_page_dirty(pager, 0);
+  unpin_page(pager, 0);
+  __atomic_store_n(&table->indexes[column], index, __ATOMIC_RELEASE);
+  table_write_end(table);
+  return EXECUTE_SUCCESS;
+}
 
-    if (i == cursor->cell_num) {
-      serialize_row(value, destination);
-    } else if (i > cursor->cell_num) {
-      memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
-    } else {
-      memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+// puts every page of the tree below page_num on the freelist. a page
+// the crash kept from reaching the file reads as zeros, which looks like
+// an internal node whose only child is the header, so page 0 is skipped
+void free_tree(Pager *pager, uint32_t page_num) {
+  if (page_num == 0) {
+    return;
+  }
+  void *node = get_page(pager, page_num);
+  uint32_t num_children = 0;
+  uint32_t children[pager->internal_node_max_keys + 1];
+  if (get_node_type(node) == NODE_INTERNAL) {
+    num_children = *internal_node_num_keys(node) + 1;
+    for (uint32_t i = 0; i < num_children; i++) {
+      children[i] = *internal_node_child(node, i);
     }
   }
-
-  *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-  *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
-
-  if (is_node_root(old_node)) {
-    return create_new_root(cursor->table, new_page_num);
-  } else {
-    printf("Need to implement updating parent after the split.\n");
-    exit(EXIT_FAILURE);
+  unpin_page(pager, page_num);
+  for (uint32_t i = 0; i < num_children; i++) {
+    free_tree(pager, children[i]);
   }
+  free_page(pager, page_num);
 }
 
-// this method is used to insert a row into the database
-void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value) {
-  // we get the page that the cursor is pointing to
-  void *node = get_page(cursor->table->pager, cursor->page_num);
-
-  // we check if the number of cells is greater than
-  // the max limit if yes we split the rows across leaf nodes
-  uint32_t num_cells = *leaf_node_num_cells(node);
-  if (num_cells >= LEAF_NODE_MAX_CELLS) {
-    leaf_node_split_and_insert(cursor, key, value);
+// drops the indexes whose build a crash cut short, their pages go back
+// to the freelist. create index can be run again for them
+void index_discard_unfinished(Table *table) {
+  Pager *pager = table->pager;
+  FileHeader *header = get_page(pager, 0);
+  uint32_t building_indexes = header->building_indexes;
+  unpin_page(pager, 0);
+  if (building_indexes == 0) {
     return;
   }
-
-  // moving cells to make space for inserting new cell
-  if (cursor->cell_num < num_cells) {
-    // to make space for new cell
-    for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-      memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1),
-             LEAF_NODE_CELL_SIZE);
+  for (uint32_t i = 0; i < NUM_STRING_COLUMNS; i++) {
+    if (!(building_indexes & (1 << i)) || table->indexes[i] == NULL) {
+      continue;
     }
+    free_tree(pager, table->indexes[i]->root_page_num);
+    free(table->indexes[i]);
+    table->indexes[i] = NULL;
+    header = get_page(pager, 0);
+    header->index_root_page_nums[i] = 0;
+    mark_page_dirty(pager, 0);
+    unpin_page(pager, 0);
   }
-
-  // after insertion increment the num cells for the node
-  *(leaf_node_num_cells(node)) += 1;
-  *(leaf_node_key(node, cursor->cell_num)) = key;
-  // store the value / row in the newly created space
-  serialize_row(value, leaf_node_value(node, cursor->cell_num));
+  header = get_page(pager, 0);
+  header->building_indexes = 0;
+  mark_page_dirty(pager, 0);
+  unpin_page(pager, 0);
+  pager_commit(pager);
 }
 
 // this method is used to create a pointer to the newly created input buffer
@@ -659,72 +4939,794 @@ void read_input(InputBuffer *input_buffer) {
     exit(EXIT_FAILURE);
   }
 
-  // ignoring the trailing newline
-  input_buffer->input_length = bytes_read - 1;
-  input_buffer->buffer[bytes_read - 1] = 0;
-}
+  // ignoring the trailing newline
+  input_buffer->input_length = bytes_read - 1;
+  input_buffer->buffer[bytes_read - 1] = 0;
+}
+
+// this method is a meta command to print of some node and row
+// related constants
+void print_constants(Pager *pager) {
+  printf("ROW_SIZE: %d\n", ROW_SIZE);
+  printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+  printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+  printf("LEAF_NODE_SLOT_SIZE: %d\n", LEAF_NODE_SLOT_SIZE);
+  printf("LEAF_NODE_MAX_CELL_SIZE: %d\n", LEAF_NODE_MAX_CELL_SIZE);
+  printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", pager->leaf_node_space_for_cells);
+}
+
+void indent(uint32_t level) {
+  for (uint32_t i = 0; i < level; i++) {
+    printf("  ");
+  }
+}
+
+void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level) {
+  void *node = get_page(pager, page_num);
+  uint32_t num_keys, child;
+
+  switch (get_node_type(node)) {
+    case (NODE_LEAF):
+      num_keys = *leaf_node_num_cells(node);
+      indent(indentation_level);
+      printf("- leaf (size %d)\n", num_keys);
+      for (uint32_t i = 0; i < num_keys; i++) {
+        indent(indentation_level + 1);
+        printf("- %d\n", *leaf_node_key(node, i));
+      }
+      break;
+    case (NODE_INTERNAL):
+      num_keys = *internal_node_num_keys(node);
+      indent(indentation_level);
+      printf("- internal (size %d)\n", num_keys);
+      for (uint32_t i = 0; i < num_keys; i++) {
+        child = *internal_node_child(node, i);
+        print_tree(pager, child, indentation_level + 1);
+
+        indent(indentation_level + 1);
+        printf("- key %d\n", *internal_node_key(node, i));
+      }
+      child = *internal_node_right_child(node);
+      print_tree(pager, child, indentation_level + 1);
+      break;
+  }
+  unpin_page(pager, page_num);
+}
+
+// outcome of reading a single row of a bulk load file
+typedef enum { LOAD_ROW_OK, LOAD_ROW_END, LOAD_ROW_INVALID } LoadRowResult;
+
+// rows sorted in memory at once by the bulk loader, larger inputs are
+// cut into sorted runs of this size and merged afterwards
+#define LOAD_RUN_ROWS 65536
+
+// sorted rows handed to the tree builder. the rows either sit in one
+// sorted array or are merged on the fly from sorted runs kept in
+// temporary files, heads holds the next row of every run. num_bytes is
+// the space all rows take as cells of a leaf, slots included
+typedef struct {
+  Row *rows;
+  uint32_t num_rows;
+  uint64_t num_bytes;
+  uint32_t position;
+  FILE **runs;
+  Row *heads;
+  bool *has_head;
+  uint32_t num_runs;
+} LoadSource;
+
+// reads one csv field into field, which has room for size - 1 bytes.
+// a field in double quotes may hold commas, line breaks and quotes,
+// which are written twice, a field without quotes may not hold any.
+// *end is set to what ended the field: ',', '\n' or EOF, a line may end
+// in "\r\n" as well. a field that is empty, too long or badly quoted is
+// invalid. the file is read by a single thread, so without locking
+LoadRowResult load_read_field(FILE *file, char *field, size_t size,
+                              int *end) {
+  size_t length = 0;
+  int c = getc_unlocked(file);
+  bool quoted = c == '"';
+  if (quoted) {
+    while (true) {
+      c = getc_unlocked(file);
+      if (c == EOF) {
+        return LOAD_ROW_INVALID;
+      }
+      if (c == '"') {
+        c = getc_unlocked(file);
+        if (c != '"') {
+          break;
+        }
+      }
+      if (length + 1 >= size) {
+        return LOAD_ROW_INVALID;
+      }
+      field[length++] = c;
+    }
+  }
+  for (; c != ',' && c != '\r' && c != '\n' && c != EOF;
+       c = getc_unlocked(file)) {
+    if (quoted || c == '"' || length + 1 >= size) {
+      return LOAD_ROW_INVALID;
+    }
+    field[length++] = c;
+  }
+  if (c == '\r') {
+    c = getc_unlocked(file);
+    if (c != '\n' && c != EOF) {
+      return LOAD_ROW_INVALID;
+    }
+  }
+  field[length] = '\0';
+  *end = c;
+  return length > 0 ? LOAD_ROW_OK : LOAD_ROW_INVALID;
+}
+
+// reads the next row of a load file. csv files hold one
+// "id,username,email" record per row as in RFC 4180, a row with a
+// missing, empty or extra field or an id that is not a number below
+// 2^32 is invalid. binary files hold fixed size records of ROW_SIZE
+// bytes with zero padded strings
+LoadRowResult load_read_row(FILE *file, bool binary, Row *row) {
+  if (binary) {
+    uint8_t buffer[ROW_SIZE];
+    size_t bytes_read = fread(buffer, 1, ROW_SIZE, file);
+    if (bytes_read == 0) {
+      return LOAD_ROW_END;
+    }
+    if (bytes_read != ROW_SIZE) {
+      return LOAD_ROW_INVALID;
+    }
+    deserialize_row_record(buffer, row);
+    row->username[COLUMN_USERNAME_SIZE] = '\0';
+    row->email[COLUMN_EMAIL_SIZE] = '\0';
+    return LOAD_ROW_OK;
+  }
+
+  int c = getc_unlocked(file);
+  if (c == EOF) {
+    return LOAD_ROW_END;
+  }
+  ungetc(c, file);
+
+  char id_string[16];
+  int end;
+  if (load_read_field(file, id_string, sizeof(id_string), &end) !=
+          LOAD_ROW_OK ||
+      end != ',' ||
+      load_read_field(file, row->username, sizeof(row->username), &end) !=
+          LOAD_ROW_OK ||
+      end != ',' ||
+      load_read_field(file, row->email, sizeof(row->email), &end) !=
+          LOAD_ROW_OK ||
+      end == ',' || !isdigit((unsigned char)id_string[0])) {
+    return LOAD_ROW_INVALID;
+  }
+
+  char *id_end;
+  errno = 0;
+  unsigned long id = strtoul(id_string, &id_end, 10);
+  if (errno != 0 || *id_end != '\0' || id > UINT32_MAX) {
+    return LOAD_ROW_INVALID;
+  }
+  row->id = id;
+  return LOAD_ROW_OK;
+}
+
+// orders rows by id for qsort
+int compare_rows(const void *a, const void *b) {
+  uint32_t id_a = ((const Row *)a)->id;
+  uint32_t id_b = ((const Row *)b)->id;
+  return (id_a > id_b) - (id_a < id_b);
+}
+
+// sorts a run of rows unless it is already sorted, which is the common
+// case for dumps coming out of another database
+void load_sort_rows(Row *rows, uint32_t num_rows) {
+  for (uint32_t i = 1; i < num_rows; i++) {
+    if (rows[i - 1].id > rows[i].id) {
+      qsort(rows, num_rows, sizeof(Row), compare_rows);
+      return;
+    }
+  }
+}
+
+// reads the whole load file into a sorted row source, this is the
+// external sort of the loader. every LOAD_RUN_ROWS rows are sorted in
+// memory and spilled to a temporary file as a run, unless the input fits
+// in a single run in which case it stays in memory
+LoadRowResult load_open_source(FILE *file, bool binary, LoadSource *source,
+                               uint32_t *num_rows) {
+  memset(source, 0, sizeof(LoadSource));
+  source->rows = malloc(sizeof(Row) * LOAD_RUN_ROWS);
+  *num_rows = 0;
+
+  while (true) {
+    LoadRowResult result = LOAD_ROW_OK;
+    while (source->num_rows < LOAD_RUN_ROWS) {
+      result = load_read_row(file, binary, &source->rows[source->num_rows]);
+      if (result != LOAD_ROW_OK) {
+        break;
+      }
+      Row *row = &source->rows[source->num_rows];
+      source->num_bytes += row_value_size(row) + LEAF_NODE_SLOT_SIZE;
+      source->num_rows += 1;
+    }
+    if (result == LOAD_ROW_INVALID) {
+      return LOAD_ROW_INVALID;
+    }
+
+    load_sort_rows(source->rows, source->num_rows);
+    *num_rows += source->num_rows;
+    if (result == LOAD_ROW_END && source->num_runs == 0) {
+      return LOAD_ROW_OK;
+    }
+
+    // spill the sorted run so the memory can be used for the next one
+    if (source->num_rows > 0) {
+      source->runs =
+          realloc(source->runs, sizeof(FILE *) * (source->num_runs + 1));
+      FILE *run = tmpfile();
+      if (run == NULL) {
+        printf("Unable to create a temporary file for sorting.\n");
+        exit(EXIT_FAILURE);
+      }
+      uint8_t buffer[ROW_SIZE];
+      for (uint32_t i = 0; i < source->num_rows; i++) {
+        serialize_row_record(&source->rows[i], buffer);
+        fwrite(buffer, ROW_SIZE, 1, run);
+      }
+      rewind(run);
+      source->runs[source->num_runs++] = run;
+      source->num_rows = 0;
+    }
+
+    if (result == LOAD_ROW_END) {
+      break;
+    }
+  }
+
+  // prime the merge with the first row of every run
+  source->heads = malloc(sizeof(Row) * source->num_runs);
+  source->has_head = malloc(sizeof(bool) * source->num_runs);
+  for (uint32_t i = 0; i < source->num_runs; i++) {
+    source->has_head[i] =
+        load_read_row(source->runs[i], true, &source->heads[i]) == LOAD_ROW_OK;
+  }
+  return LOAD_ROW_OK;
+}
+
+// hands out the rows of a load source in id order. runs are merged by
+// picking the smallest head, the number of runs is small enough that a
+// linear pick is cheaper than keeping a heap
+bool load_next_row(LoadSource *source, Row *row) {
+  if (source->num_runs == 0) {
+    if (source->position == source->num_rows) {
+      return false;
+    }
+    *row = source->rows[source->position++];
+    return true;
+  }
+
+  int32_t smallest = -1;
+  for (uint32_t i = 0; i < source->num_runs; i++) {
+    if (source->has_head[i] &&
+        (smallest == -1 || source->heads[i].id < source->heads[smallest].id)) {
+      smallest = i;
+    }
+  }
+  if (smallest == -1) {
+    return false;
+  }
+  *row = source->heads[smallest];
+  source->has_head[smallest] =
+      load_read_row(source->runs[smallest], true, &source->heads[smallest]) ==
+      LOAD_ROW_OK;
+  return true;
+}
+
+// releases the memory and temporary files of a load source
+void load_close_source(LoadSource *source) {
+  for (uint32_t i = 0; i < source->num_runs; i++) {
+    fclose(source->runs[i]);
+  }
+  free(source->runs);
+  free(source->heads);
+  free(source->has_head);
+  free(source->rows);
+}
+
+// builds the tree bottom-up from rows sorted by id, in one sequential
+// pass over the new pages. the leaves are packed to the fill factor and
+// linked left to right, then every level of internal nodes is built
+// from the page numbers and largest keys of the level below until a
+// single node is left, which is written to the root page. the root page
+// is written last, a crash before that leaves the old empty tree in place
+bool bulk_build(Table *table, LoadSource *source, uint32_t num_rows) {
+  Pager *pager = table->pager;
+  uint32_t per_leaf =
+      pager->leaf_node_space_for_cells * table->fill_percent / 100;
+  uint32_t per_internal =
+      (pager->internal_node_max_keys + 1) * table->fill_percent / 100;
+  // a leaf may pass its share by one cell, which has to fit as well
+  uint32_t max_per_leaf = pager->leaf_node_space_for_cells -
+                          LEAF_NODE_MAX_CELL_SIZE - LEAF_NODE_SLOT_SIZE;
+  if (per_leaf > max_per_leaf) {
+    per_leaf = max_per_leaf;
+  }
+  if (per_leaf < LEAF_NODE_MAX_CELL_SIZE + LEAF_NODE_SLOT_SIZE) {
+    per_leaf = LEAF_NODE_MAX_CELL_SIZE + LEAF_NODE_SLOT_SIZE;
+  }
+  if (per_internal < 3) {
+    per_internal = 3;
+  }
+
+  // the bytes are spread evenly so the last leaf is not left nearly
+  // empty, every leaf ends at the last row below its share
+  uint32_t num_nodes = (source->num_bytes + per_leaf - 1) / per_leaf;
+  uint32_t *pages = malloc(sizeof(uint32_t) * num_nodes);
+  uint32_t *max_keys = malloc(sizeof(uint32_t) * num_nodes);
+  uint32_t page_num = num_nodes == 1 ? table->root_page_num
+                                     : get_unused_page_num(pager);
+  // a single leaf is built aside and copied to the root once it is
+  // complete, so a duplicate leaves the empty root as it was
+  void *scratch = num_nodes == 1 ? malloc(pager->page_size) : NULL;
+  uint8_t cell[LEAF_NODE_MAX_CELL_SIZE];
+  uint64_t written = 0;
+  uint32_t rows_left = num_rows;
+  bool has_previous = false;
+  Row row;
+  Row previous;
+  load_next_row(source, &row);
+
+  for (uint32_t i = 0; i < num_nodes; i++) {
+    uint64_t boundary = source->num_bytes * (i + 1) / num_nodes;
+    bool last = i + 1 == num_nodes;
+    uint32_t next_page_num = last ? 0 : get_unused_page_num(pager);
+    void *node = scratch != NULL ? scratch : get_page(pager, page_num);
+    initialize_leaf_node(node, pager->page_size);
+    set_node_root(node, num_nodes == 1);
+    *leaf_node_next_leaf(node) = next_page_num;
+
+    for (uint32_t cell_num = 0; rows_left > 0; cell_num++) {
+      uint32_t size = row_value_size(&row);
+      // every leaf after this one still needs a row
+      if (cell_num > 0 && !last &&
+          (written + size + LEAF_NODE_SLOT_SIZE > boundary ||
+           rows_left <= num_nodes - i - 1)) {
+        break;
+      }
+      if (has_previous && row.id == previous.id) {
+        // the root was not touched yet, so the leaves written so far
+        // are not reachable and go back on the freelist
+        if (num_nodes > 1) {
+          unpin_page(pager, page_num);
+          for (uint32_t j = 0; j < i; j++) {
+            free_page(pager, pages[j]);
+          }
+          free_page(pager, page_num);
+          if (!last) {
+            free_page(pager, next_page_num);
+          }
+        }
+        free(scratch);
+        free(pages);
+        free(max_keys);
+        return false;
+      }
+      serialize_row_value(&row, cell);
+      leaf_node_insert_cell(node, pager->page_size, cell_num, row.id, cell,
+                            size);
+      written += size + LEAF_NODE_SLOT_SIZE;
+      previous = row;
+      has_previous = true;
+      rows_left -= 1;
+      if (rows_left > 0) {
+        load_next_row(source, &row);
+      }
+    }
+
+    pages[i] = page_num;
+    max_keys[i] = *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+    if (scratch != NULL) {
+      memcpy(get_page(pager, page_num), scratch, pager->page_size);
+      free(scratch);
+    }
+    mark_page_dirty(pager, page_num);
+    unpin_page(pager, page_num);
+    pager_commit_if_large(pager);
+    page_num = next_page_num;
+  }
+
+  // the table was empty, a single leaf and no bytes
+  table_shape_add(&table->shape.num_leaves, num_nodes - 1);
+  table_shape_add(&table->shape.leaf_bytes_used, written);
+  while (num_nodes > 1) {
+    // the level that fits in a single node becomes the root
+    uint32_t num_children = num_nodes;
+    num_nodes = (num_children + per_internal - 1) / per_internal;
+    if (num_children <= pager->internal_node_max_keys + 1) {
+      num_nodes = 1;
+    }
+    table_shape_add(&table->shape.num_internal, num_nodes);
+    table_shape_add(&table->shape.height, 1);
+
+    uint32_t child = 0;
+    for (uint32_t i = 0; i < num_nodes; i++) {
+      uint32_t page_num = num_nodes == 1 ? table->root_page_num
+                                         : get_unused_page_num(pager);
+      uint32_t node_children =
+          num_children / num_nodes + (i < num_children % num_nodes);
+      void *node = get_page(pager, page_num);
+      initialize_internal_node(node);
+      set_node_root(node, num_nodes == 1);
+
+      *internal_node_num_keys(node) = node_children - 1;
+      for (uint32_t j = 0; j < node_children - 1; j++) {
+        *internal_node_child(node, j) = pages[child];
+        *internal_node_key(node, j) = max_keys[child];
+        child += 1;
+      }
+      *internal_node_right_child(node) = pages[child];
+
+      // the level below is consumed in order, so the arrays are reused
+      pages[i] = page_num;
+      max_keys[i] = max_keys[child];
+      child += 1;
+      mark_page_dirty(pager, page_num);
+      unpin_page(pager, page_num);
+      pager_commit_if_large(pager);
+    }
+  }
+
+  free(pages);
+  free(max_keys);
+  return true;
+}
+
+// loads the rows of a csv or binary file into the table.
+// an empty table is built bottom-up from the sorted rows, otherwise the
+// rows are inserted one at a time into the existing tree
+void load_file(Table *table, const char *filename, bool binary) {
+  FILE *file = fopen(filename, binary ? "rb" : "r");
+  if (file == NULL) {
+    printf("Unable to open load file '%s'.\n", filename);
+    return;
+  }
+
+  LoadSource source;
+  uint32_t num_rows;
+  LoadRowResult result = load_open_source(file, binary, &source, &num_rows);
+  fclose(file);
+  if (result == LOAD_ROW_INVALID) {
+    printf("Error: Invalid row in load file.\n");
+    load_close_source(&source);
+    return;
+  }
+
+  table_write_begin(table);
+  void *root = get_page(table->pager, table->root_page_num);
+  bool empty =
+      get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+  unpin_page(table->pager, table->root_page_num);
+
+  bool loaded = true;
+  if (empty && num_rows > 0) {
+    // readers wait at the root until the tree below it is built
+    Cursor *cursor = table_seek(table, 0, DESCEND_EXCLUSIVE);
+    loaded = bulk_build(table, &source, num_rows);
+    cursor_close(cursor);
+    if (loaded) {
+      table_count_rows(table, num_rows);
+      // the indexes are filled from the finished tree
+      for (uint32_t i = 0; i < NUM_STRING_COLUMNS; i++) {
+        if (table->indexes[i] != NULL) {
+          table_scan(table, 0, UINT32_MAX, index_scanned_row,
+                     table->indexes[i]);
+        }
+      }
+    }
+  } else {
+    Row row;
+    while (load_next_row(&source, &row)) {
+      if (table_insert_row(table, &row) == EXECUTE_DUPLICATE_KEY) {
+        loaded = false;
+        break;
+      }
+      pager_commit_if_large(table->pager);
+    }
+  }
+  load_close_source(&source);
+  table_write_end(table);
+
+  if (loaded) {
+    printf("Loaded %d rows.\n", num_rows);
+  } else {
+    printf("Error: Duplicate key.\n");
+  }
+}
+
+// merges a sorted group of rows into the leaf the cursor points at.
+// when the group fits, the new cells are written to the free space and
+// the slots are merged from the back, so every old slot moves once and
+// the old cells stay where they are. otherwise the old and new cells
+// are spread evenly by size over as many leaves as needed and the new
+// leaves are registered with the parents one after the other. a split
+// can move the parent of the leaf, so each registration descends again
+// instead of reusing the path
+void leaf_node_insert_rows(Cursor *cursor, Row *rows, uint32_t num_rows) {
+  Table *table = cursor->table;
+  Pager *pager = table->pager;
+  void *node = get_page(pager, cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t needed = 0;
+  for (uint32_t i = 0; i < num_rows; i++) {
+    needed += row_value_size(&rows[i]) + LEAF_NODE_SLOT_SIZE;
+  }
+  table_shape_add(&table->shape.leaf_bytes_used, needed);
+
+  if (needed <= leaf_node_free_space(node)) {
+    uint32_t slots_end =
+        LEAF_NODE_HEADER_SIZE + num_cells * LEAF_NODE_SLOT_SIZE;
+    if (*leaf_node_content_start(node) - slots_end < needed) {
+      leaf_node_compact(node, pager->page_size);
+    }
+    uint16_t *offsets = malloc(num_rows * sizeof(uint16_t));
+    for (uint32_t i = 0; i < num_rows; i++) {
+      *leaf_node_content_start(node) -= row_value_size(&rows[i]);
+      offsets[i] = *leaf_node_content_start(node);
+      serialize_row_value(&rows[i], node + offsets[i]);
+    }
+
+    leaf_node_set_num_cells(node, num_cells + num_rows);
+    int32_t cell = num_cells - 1;
+    int32_t row = num_rows - 1;
+    for (int32_t i = num_cells + num_rows - 1; row >= 0; i--) {
+      if (cell >= 0 && *leaf_node_key(node, cell) > rows[row].id) {
+        *leaf_node_key(node, i) = *leaf_node_key(node, cell);
+        *leaf_node_slot(node, i) = *leaf_node_slot(node, cell);
+        cell--;
+      } else {
+        *leaf_node_key(node, i) = rows[row].id;
+        *leaf_node_slot(node, i) = offsets[row];
+        row--;
+      }
+    }
+    free(offsets);
+    mark_page_dirty(pager, cursor->page_num);
+    unpin_page(pager, cursor->page_num);
+    return;
+  }
+
+  // merge the old cells and the rows into one sorted run, offsets[i] is
+  // where cell i starts and offsets[total] where the run ends
+  uint32_t total = num_cells + num_rows;
+  uint8_t *cells = malloc(pager->leaf_node_space_for_cells -
+                          leaf_node_free_space(node) + needed);
+  uint32_t *offsets = malloc((total + 1) * sizeof(uint32_t));
+  uint32_t *keys = malloc(total * sizeof(uint32_t));
+  uint32_t cell = 0;
+  uint32_t row = 0;
+  offsets[0] = 0;
+  for (uint32_t i = 0; i < total; i++) {
+    void *destination = cells + offsets[i];
+    uint32_t size;
+    if (row == num_rows ||
+        (cell < num_cells && *leaf_node_key(node, cell) < rows[row].id)) {
+      size = leaf_node_cell_size(leaf_node_cell(node, cell));
+      memcpy(destination, leaf_node_cell(node, cell), size);
+      keys[i] = *leaf_node_key(node, cell);
+      cell++;
+    } else {
+      size = row_value_size(&rows[row]);
+      serialize_row_value(&rows[row], destination);
+      keys[i] = rows[row].id;
+      row++;
+    }
+    offsets[i + 1] = offsets[i] + size;
+  }
 
-// this method is a meta command to print of some node and row
-// related constants
-void print_constants() {
-  printf("ROW_SIZE: %d\n", ROW_SIZE);
-  printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
-  printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-  printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-  printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-  printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
-}
+  // every leaf ends at the last cell below its share of the bytes, a
+  // share leaves room for one more cell so the last leaf fits as well
+  uint32_t total_bytes = offsets[total] + total * LEAF_NODE_SLOT_SIZE;
+  uint32_t share = pager->leaf_node_space_for_cells - LEAF_NODE_MAX_CELL_SIZE -
+                   LEAF_NODE_SLOT_SIZE;
+  uint32_t num_leaves = (total_bytes + share - 1) / share;
+  stats_add(&table->leaf_splits, num_leaves - 1);
+  table_shape_add(&table->shape.num_leaves, num_leaves - 1);
+  uint32_t *pages = malloc(num_leaves * sizeof(uint32_t));
+  uint32_t *max_keys = malloc(num_leaves * sizeof(uint32_t));
+  uint32_t next_leaf = *leaf_node_next_leaf(node);
+  unpin_page(pager, cursor->page_num);
+
+  uint32_t start = 0;
+  for (uint32_t i = 0; i < num_leaves; i++) {
+    uint64_t boundary = (uint64_t)total_bytes * (i + 1) / num_leaves;
+    uint32_t end = start + 1;
+    if (i + 1 == num_leaves) {
+      end = total;
+    }
+    while (end < total &&
+           offsets[end + 1] + (end + 1) * LEAF_NODE_SLOT_SIZE <= boundary) {
+      end++;
+    }
 
-void indent(uint32_t level) {
-  for (uint32_t i = 0; i < level; i++) {
-    printf("  ");
+    if (i == 0) {
+      pages[i] = cursor->page_num;
+    }
+    if (i + 1 < num_leaves) {
+      pages[i + 1] = get_unused_page_num(pager);
+    }
+    void *leaf = get_page(pager, pages[i]);
+    initialize_leaf_node(leaf, pager->page_size);
+    set_node_root(leaf, i == 0 && cursor->depth == 0);
+    for (uint32_t j = start; j < end; j++) {
+      leaf_node_insert_cell(leaf, pager->page_size, j - start, keys[j],
+                            cells + offsets[j], offsets[j + 1] - offsets[j]);
+    }
+    // the page of the next leaf is reserved up front so it can be linked
+    *leaf_node_next_leaf(leaf) =
+        i + 1 == num_leaves ? next_leaf : pages[i + 1];
+    max_keys[i] = keys[end - 1];
+    mark_page_dirty(pager, pages[i]);
+    unpin_page(pager, pages[i]);
+    start = end;
+  }
+  free(cells);
+  free(offsets);
+  free(keys);
+
+  for (uint32_t i = 1; i < num_leaves; i++) {
+    Cursor *left = table_find(table, max_keys[i - 1]);
+    if (left->depth == 0) {
+      create_new_root(table, pages[i]);
+    } else {
+      internal_node_insert(left, left->depth - 1, left->page_num,
+                           max_keys[i - 1], pages[i]);
+    }
+    free(left);
   }
+  free(pages);
+  free(max_keys);
 }
 
-void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level) {
-  void *node = get_page(pager, page_num);
-  uint32_t num_keys, child;
+// inserts a batch of rows with one descent per leaf instead of one per
+// row. the rows are sorted and every leaf gets all of its rows in a
+// single merge. the batch is all or nothing, a key that is repeated or
+// already in the table rejects it before anything is written.
+// a group holds at most a quarter of the buffer pool worth of leaves
+// so that, with the log enabled, a group fits in the buffer pool and the
+// batch can be committed between groups. the rows array is reordered
+ExecuteResult table_insert_rows(Table *table, Row *rows, uint32_t num_rows) {
+  Pager *pager = table->pager;
+  load_sort_rows(rows, num_rows);
+  for (uint32_t i = 1; i < num_rows; i++) {
+    if (rows[i - 1].id == rows[i].id) {
+      return EXECUTE_DUPLICATE_KEY;
+    }
+  }
 
-  switch (get_node_type(node)) {
-    case (NODE_LEAF):
-      num_keys = *leaf_node_num_cells(node);
-      indent(indentation_level);
-      printf("- leaf (size %d)\n", num_keys);
-      for (uint32_t i = 0; i < num_keys; i++) {
-        indent(indentation_level + 1);
-        printf("- %d\n", *leaf_node_key(node, i));
+  table_write_begin(table);
+  for (uint32_t i = 0; i < num_rows;) {
+    Cursor *cursor = table_find(table, rows[i].id);
+    void *node = get_page(pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t cell = cursor->cell_num;
+    for (; i < num_rows && rows[i].id <= cursor->leaf_max_key; i++) {
+      while (cell < num_cells && *leaf_node_key(node, cell) < rows[i].id) {
+        cell++;
       }
-      break;
-    case (NODE_INTERNAL):
-      num_keys = *internal_node_num_keys(node);
-      indent(indentation_level);
-      printf("- internal (size %d)\n", num_keys);
-      for (uint32_t i = 0; i < num_keys; i++) {
-        child = *internal_node_child(node, i);
-        print_tree(pager, child, indentation_level + 1);
-
-        indent(indentation_level + 1);
-        printf("- key %d\n", *internal_node_key(node, i));
+      if (cell < num_cells && *leaf_node_key(node, cell) == rows[i].id) {
+        unpin_page(pager, cursor->page_num);
+        free(cursor);
+        table_write_end(table);
+        return EXECUTE_DUPLICATE_KEY;
       }
-      child = *internal_node_right_child(node);
-      print_tree(pager, child, indentation_level + 1);
-      break;
+    }
+    unpin_page(pager, cursor->page_num);
+    free(cursor);
   }
+
+  uint64_t max_group_bytes = pager->map != NULL
+                                 ? UINT64_MAX
+                                 : (uint64_t)pager->leaf_node_space_for_cells *
+                                       (pager->num_frames / 4);
+  for (uint32_t i = 0; i < num_rows;) {
+    Cursor *cursor = table_seek(table, rows[i].id, DESCEND_WRITE_LEAF);
+    uint32_t end = i;
+    uint64_t group_bytes = 0;
+    while (end < num_rows && group_bytes < max_group_bytes &&
+           rows[end].id <= cursor->leaf_max_key) {
+      group_bytes += row_value_size(&rows[end]) + LEAF_NODE_SLOT_SIZE;
+      end++;
+    }
+
+    // a group spread over new leaves registers them with the parents one
+    // by one, which may split any node on the path, so all of it is held
+    void *node = get_page(pager, cursor->page_num);
+    bool fits = group_bytes <= leaf_node_free_space(node);
+    unpin_page(pager, cursor->page_num);
+    if (!fits) {
+      cursor_close(cursor);
+      cursor = table_seek(table, rows[i].id, DESCEND_EXCLUSIVE);
+    }
+    leaf_node_insert_rows(cursor, &rows[i], end - i);
+    cursor_close(cursor);
+    table_count_rows(table, end - i);
+    for (uint32_t j = i; j < end; j++) {
+      table_index_row(table, NULL, &rows[j]);
+      pager_commit_if_large(pager);
+    }
+    pager_commit_if_large(pager);
+    i = end;
+  }
+
+  table_write_end(table);
+  return EXECUTE_SUCCESS;
 }
 
 // this method is used to process meta commands
-MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table) {
+MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table,
+                                  ResultSink *sink) {
   if (strcmp(input_buffer->buffer, ".exit") == 0) {
     close_input_buffer(input_buffer);
+    sink_close(sink);
     db_close(table);
     exit(EXIT_SUCCESS);
   } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
     printf("Tree:\n");
-    print_tree(table->pager, 0, 0);
+    print_tree(table->pager, table->root_page_num, 0);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".checkpoint") == 0) {
+    table_write_begin(table);
+    uint32_t pages_written = pager_checkpoint(table->pager);
+    table_write_end(table);
+    printf("Checkpoint wrote %d pages.\n", pages_written);
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".load ", 6) == 0) {
+    char *keyword = strtok(input_buffer->buffer, " ");
+    char *filename = strtok(NULL, " ");
+    char *format = strtok(NULL, " ");
+    if (filename == NULL) {
+      return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+    bool binary = format != NULL && strcmp(format, "binary") == 0;
+    load_file(table, filename, binary);
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".output ", 8) == 0) {
+    // .output <path|stdout> [text|csv|binary]
+    char *keyword = strtok(input_buffer->buffer, " ");
+    char *path = strtok(NULL, " ");
+    char *format = strtok(NULL, " ");
+    if (path == NULL) {
+      return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+    if (!sink_open(sink, path)) {
+      printf("Unable to open output file.\n");
+      return META_COMMAND_SUCCESS;
+    }
+    sink->format = OUTPUT_TEXT;
+    if (format != NULL && strcmp(format, "csv") == 0) {
+      sink->format = OUTPUT_CSV;
+    } else if (format != NULL && strcmp(format, "binary") == 0) {
+      sink->format = OUTPUT_BINARY;
+    }
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".truncate") == 0) {
+    table_write_begin(table);
+    uint32_t pages_removed = pager_truncate(table->pager);
+    table_write_end(table);
+    printf("Truncate removed %d pages.\n", pages_removed);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".stats") == 0) {
+    print_stats(stdout, table, false);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".stats json") == 0) {
+    print_stats(stdout, table, true);
     return META_COMMAND_SUCCESS;
   } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
     printf("Constants:\n");
-    print_constants();
+    print_constants(table->pager);
     return META_COMMAND_SUCCESS;
   } else {
     return META_COMMAND_UNRECOGNIZED_COMMAND;
@@ -732,34 +5734,222 @@ MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table) {
 }
 
 // this method is used to perform checks before executing insert operation
+// releases the rows of a multi-row insert
+void free_statement(Statement *statement) {
+  if (statement->type == STATEMENT_INSERT &&
+      statement->rows != &statement->row_to_insert) {
+    free(statement->rows);
+  }
+  statement->rows = &statement->row_to_insert;
+}
+
 PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement) {
   statement->type = STATEMENT_INSERT;
+  statement->rows = &statement->row_to_insert;
+  statement->num_rows = 0;
+  uint32_t capacity = 1;
 
   char *keyword = strtok(input_buffer->buffer, " ");
-  char *id_string = strtok(NULL, " ");
-  char *username = strtok(NULL, " ");
-  char *email = strtok(NULL, " ");
+  // "insert 1 a a@x 2 b b@x" inserts both rows in one statement
+  while (true) {
+    char *id_string = strtok(NULL, " ");
+    if (id_string == NULL && statement->num_rows > 0) {
+      return PREPARE_SUCCESS;
+    }
+    char *username = strtok(NULL, " ");
+    char *email = strtok(NULL, " ");
+
+    PrepareResult result = PREPARE_SUCCESS;
+    if (id_string == NULL || username == NULL || email == NULL) {
+      result = PREPARE_SYNTAX_ERROR;
+    } else if (atoi(id_string) < 0) {
+      result = PREPARE_NEGATIVE_ID;
+    } else if (strlen(username) > COLUMN_USERNAME_SIZE ||
+               strlen(email) > COLUMN_EMAIL_SIZE) {
+      result = PREPARE_STRING_TOO_LONG;
+    }
+    if (result != PREPARE_SUCCESS) {
+      free_statement(statement);
+      return result;
+    }
 
-  if (id_string == NULL || username == NULL || email == NULL) {
-    return PREPARE_SYNTAX_ERROR;
+    if (statement->num_rows == capacity) {
+      capacity *= 2;
+      if (statement->rows == &statement->row_to_insert) {
+        statement->rows = malloc(capacity * sizeof(Row));
+        statement->rows[0] = statement->row_to_insert;
+      } else {
+        statement->rows = realloc(statement->rows, capacity * sizeof(Row));
+      }
+    }
+
+    Row *row = &statement->rows[statement->num_rows++];
+    row->id = atoi(id_string);
+    strcpy(row->username, username);
+    strcpy(row->email, email);
   }
+}
 
-  int id = atoi(id_string);
+// a select either reads the whole table, a single row with
+// "select <id>" or, with "select where id between <a> and <b>",
+// only the ids from a to b. "select where username = <name>" only reads
+// the rows with that username, "where email = <address>" works the same
+// way. a list of count(*), min(id) and max(id)
+// after the keyword, as in "select count(*), max(id) where ...",
+// computes those over the rows instead of returning them
+PrepareResult prepare_select(InputBuffer *input_buffer, Statement *statement) {
+  statement->type = STATEMENT_SELECT;
+  statement->range_start = 0;
+  statement->range_end = UINT32_MAX;
+  statement->filter = false;
+  statement->num_aggregates = 0;
 
-  if (id < 0) {
+  char *keyword = strtok(input_buffer->buffer, " ");
+  char *where = strtok(NULL, " ");
+  if (where == NULL) {
+    return PREPARE_SUCCESS;
+  }
+
+  if (isdigit(where[0]) || where[0] == '-') {
+    if (strtok(NULL, " ") != NULL) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    int id = atoi(where);
+    if (id < 0) {
+      return PREPARE_NEGATIVE_ID;
+    }
+    statement->type = STATEMENT_SELECT_KEY;
+    statement->range_start = id;
+    statement->range_end = id;
+    return PREPARE_SUCCESS;
+  }
+
+  // the list may be split into words anywhere, "count(*),min(id)" and
+  // "count(*), min(id)" are the same
+  while (where != NULL && strcmp(where, "where") != 0) {
+    char *position;
+    for (char *name = strtok_r(where, ",", &position); name != NULL;
+         name = strtok_r(NULL, ",", &position)) {
+      if (statement->num_aggregates == MAX_AGGREGATES) {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      Aggregate *aggregate =
+          &statement->aggregates[statement->num_aggregates++];
+      if (strcmp(name, "count(*)") == 0) {
+        *aggregate = AGGREGATE_COUNT;
+      } else if (strcmp(name, "min(id)") == 0) {
+        *aggregate = AGGREGATE_MIN_ID;
+      } else if (strcmp(name, "max(id)") == 0) {
+        *aggregate = AGGREGATE_MAX_ID;
+      } else {
+        return PREPARE_SYNTAX_ERROR;
+      }
+    }
+    where = strtok(NULL, " ");
+  }
+  if (statement->num_aggregates > 0) {
+    statement->type = STATEMENT_AGGREGATE;
+  }
+  if (where == NULL) {
+    return PREPARE_SUCCESS;
+  }
+
+  char *column = strtok(NULL, " ");
+  if (column != NULL && (strcmp(column, "username") == 0 ||
+                         strcmp(column, "email") == 0)) {
+    char *equals = strtok(NULL, " ");
+    char *value = strtok(NULL, " ");
+    if (equals == NULL || strcmp(equals, "=") != 0 || value == NULL ||
+        strtok(NULL, " ") != NULL) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->column =
+        strcmp(column, "username") == 0 ? COLUMN_USERNAME : COLUMN_EMAIL;
+    if (strlen(value) > (statement->column == COLUMN_USERNAME
+                             ? COLUMN_USERNAME_SIZE
+                             : COLUMN_EMAIL_SIZE)) {
+      return PREPARE_STRING_TOO_LONG;
+    }
+    statement->filter = true;
+    strcpy(statement->value, value);
+    return PREPARE_SUCCESS;
+  }
+
+  char *between = strtok(NULL, " ");
+  char *start_string = strtok(NULL, " ");
+  char *and = strtok(NULL, " ");
+  char *end_string = strtok(NULL, " ");
+
+  if (strcmp(where, "where") != 0 || column == NULL ||
+      strcmp(column, "id") != 0 || between == NULL ||
+      strcmp(between, "between") != 0 || start_string == NULL ||
+      and == NULL || strcmp(and, "and") != 0 || end_string == NULL ||
+      strtok(NULL, " ") != NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  int range_start = atoi(start_string);
+  int range_end = atoi(end_string);
+  if (range_start < 0 || range_end < 0) {
     return PREPARE_NEGATIVE_ID;
   }
-  if (strlen(username) > COLUMN_USERNAME_SIZE) {
-    return PREPARE_STRING_TOO_LONG;
+
+  statement->range_start = range_start;
+  statement->range_end = range_end;
+  return PREPARE_SUCCESS;
+}
+
+// "update <id> <username> <email>" replaces the row with the given id,
+// it is parsed like an insert of a single row
+PrepareResult prepare_update(InputBuffer *input_buffer, Statement *statement) {
+  PrepareResult result = prepare_insert(input_buffer, statement);
+  if (result != PREPARE_SUCCESS) {
+    return result;
+  }
+  if (statement->num_rows != 1) {
+    free_statement(statement);
+    return PREPARE_SYNTAX_ERROR;
+  }
+  statement->type = STATEMENT_UPDATE;
+  return PREPARE_SUCCESS;
+}
+
+// "delete <id>" removes the row with the given id
+PrepareResult prepare_delete(InputBuffer *input_buffer, Statement *statement) {
+  statement->type = STATEMENT_DELETE;
+
+  char *keyword = strtok(input_buffer->buffer, " ");
+  char *id_string = strtok(NULL, " ");
+  if (id_string == NULL || strtok(NULL, " ") != NULL) {
+    return PREPARE_SYNTAX_ERROR;
   }
-  if (strlen(email) > COLUMN_EMAIL_SIZE) {
-    return PREPARE_STRING_TOO_LONG;
+  int id = atoi(id_string);
+  if (id < 0) {
+    return PREPARE_NEGATIVE_ID;
   }
+  statement->range_start = id;
+  return PREPARE_SUCCESS;
+}
 
-  statement->row_to_insert.id = id;
-  strcpy(statement->row_to_insert.username, username);
-  strcpy(statement->row_to_insert.email, email);
+// "create index on <username|email>" creates the index of the column
+PrepareResult prepare_create(InputBuffer *input_buffer, Statement *statement) {
+  statement->type = STATEMENT_CREATE_INDEX;
 
+  char *keyword = strtok(input_buffer->buffer, " ");
+  char *index = strtok(NULL, " ");
+  char *on = strtok(NULL, " ");
+  char *column = strtok(NULL, " ");
+  if (index == NULL || strcmp(index, "index") != 0 || on == NULL ||
+      strcmp(on, "on") != 0 || column == NULL || strtok(NULL, " ") != NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (strcmp(column, "username") == 0) {
+    statement->column = COLUMN_USERNAME;
+  } else if (strcmp(column, "email") == 0) {
+    statement->column = COLUMN_EMAIL;
+  } else {
+    return PREPARE_SYNTAX_ERROR;
+  }
   return PREPARE_SUCCESS;
 }
 
@@ -770,128 +5960,559 @@ PrepareResult prepare_statement(InputBuffer *input_buffer,
     return prepare_insert(input_buffer, statement);
   }
   if (strncmp(input_buffer->buffer, "select", 6) == 0) {
-    statement->type = STATEMENT_SELECT;
-    return PREPARE_SUCCESS;
+    return prepare_select(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "update", 6) == 0) {
+    return prepare_update(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "delete", 6) == 0) {
+    return prepare_delete(input_buffer, statement);
+  }
+  if (strncmp(input_buffer->buffer, "create", 6) == 0) {
+    return prepare_create(input_buffer, statement);
   }
   return PREPARE_UNRECOGNIZED_STATEMENT;
 }
 
 // this method is used to insert rows into table
 ExecuteResult execute_insert(Statement *statement, Table *table) {
-  void *node = get_page(table->pager, table->root_page_num);
-  uint32_t num_cells = (*leaf_node_num_cells(node));
+  if (statement->num_rows > 1) {
+    return table_insert_rows(table, statement->rows, statement->num_rows);
+  }
+  return table_insert(table, &(statement->row_to_insert));
+}
+
+void sink_scanned_row(Row *row, void *argument) {
+  sink_write_row(argument, row);
+}
 
-  Row *row_to_insert = &(statement->row_to_insert);
+// the index a filter of a select can use, or NULL
+Table *statement_index(Statement *statement, Table *table) {
+  if (!statement->filter) {
+    return NULL;
+  }
+  return __atomic_load_n(&table->indexes[statement->column],
+                         __ATOMIC_ACQUIRE);
+}
 
-  uint32_t key_to_insert = row_to_insert->id;
-  //
-  Cursor *cursor = table_find(table, key_to_insert);
+// reads the row with an id the index named for the filter of a select.
+// the row is only taken if it lies in the range and its column still
+// holds the value, a writer may have changed it since
+bool statement_index_row(Statement *statement, Table *table, uint32_t id,
+                         Row *row) {
+  return id >= statement->range_start && id <= statement->range_end &&
+         table_get(table, id, row) &&
+         strcmp(row_column(row, statement->column), statement->value) == 0;
+}
 
-  if (cursor->cell_num < num_cells) {
-    uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-    if (key_at_index == key_to_insert) {
-      return EXECUTE_DUPLICATE_KEY;
+// this method is used to show the rows of a table within the id range.
+// only the leaves holding the range are read. a filter on an indexed
+// column reads the rows the index names, checking each against the
+// filter in case a writer changed it since. a filter on any other column
+// has to look at every row, so those scans are spread over threads
+ExecuteResult execute_select(Statement *statement, Table *table,
+                             ResultSink *sink) {
+  Table *index = statement_index(statement, table);
+  if (index != NULL) {
+    uint32_t *ids;
+    uint32_t num_ids = index_lookup(index, statement->value, &ids);
+    for (uint32_t i = 0; i < num_ids; i++) {
+      Row row;
+      if (statement_index_row(statement, table, ids[i], &row)) {
+        sink_write_row(sink, &row);
+      }
     }
+    free(ids);
+  } else if (statement->filter) {
+    ScanPartial result;
+    table_parallel_scan(table, statement->range_start, statement->range_end,
+                        statement->column, statement->value,
+                        sink_scanned_row, sink, &result);
+  } else {
+    table_scan(table, statement->range_start, statement->range_end,
+               sink_scanned_row, sink);
   }
+  sink_flush(sink);
+  return EXECUTE_SUCCESS;
+}
 
-  leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-
-  free(cursor);
+// computes the aggregates of a select and writes them to sink as one
+// tuple. without a filter the ids in the tree are all it takes, with a
+// filter on an indexed column the rows the index names for the value,
+// checked like a select does. otherwise every row is looked at in a
+// parallel scan
+ExecuteResult execute_aggregate(Statement *statement, Table *table,
+                                ResultSink *sink) {
+  ScanPartial result;
+  bool found;
+  Table *index = statement_index(statement, table);
+  if (index != NULL) {
+    uint32_t *ids;
+    uint32_t num_ids = index_lookup(index, statement->value, &ids);
+    memset(&result, 0, sizeof(ScanPartial));
+    for (uint32_t i = 0; i < num_ids; i++) {
+      Row row;
+      if (statement_index_row(statement, table, ids[i], &row)) {
+        if (result.count == 0) {
+          result.min_id = ids[i];
+        }
+        result.max_id = ids[i];
+        result.count += 1;
+      }
+    }
+    free(ids);
+    found = result.count > 0;
+  } else if (statement->filter) {
+    table_parallel_scan(table, statement->range_start, statement->range_end,
+                        statement->column, statement->value, NULL, NULL,
+                        &result);
+    found = result.count > 0;
+  } else {
+    bool count = false;
+    for (uint32_t i = 0; i < statement->num_aggregates; i++) {
+      count = count || statement->aggregates[i] == AGGREGATE_COUNT;
+    }
+    found = table_aggregate(table, statement->range_start,
+                            statement->range_end, count, &result.count,
+                            &result.min_id, &result.max_id);
+  }
 
+  sink_write_aggregates(sink, statement->aggregates,
+                        statement->num_aggregates, result.count,
+                        result.min_id, result.max_id, found);
+  sink_flush(sink);
   return EXECUTE_SUCCESS;
 }
 
-// this method is used to show all the rows in a table
-ExecuteResult execute_select(Statement *statement, Table *table) {
-  // we initialize the cursor at the start of the table
-  Cursor *cursor = table_start(table);
+// this method is used to fetch a single row by its id
+ExecuteResult execute_select_key(Statement *statement, Table *table,
+                                 ResultSink *sink) {
   Row row;
-
-  // we keep incrementing rows unless we have reached the end of the table
-  while (!(cursor->end_of_table)) {
-    deserialize_row(cursor_value(cursor), &row);
-    print_row(&row);
-    // after printing the row to console we increment
-    // the cursor to point to the next row
-    cursor_advance(cursor);
+  if (!table_get(table, statement->range_start, &row)) {
+    return EXECUTE_KEY_NOT_FOUND;
   }
-
-  free(cursor);
-
+  sink_write_row(sink, &row);
+  sink_flush(sink);
   return EXECUTE_SUCCESS;
 }
 
-// we execute actual SQL statements here
-ExecuteResult execute_statement(Statement *statement, Table *table) {
+// we execute actual SQL statements here, selected rows go to sink.
+// the time inserts and selects of any kind take goes into the stats
+ExecuteResult execute_statement(Statement *statement, Table *table,
+                                ResultSink *sink) {
+  Stats *stats = &table->pager->stats;
+  uint64_t start = stats_now();
+  ExecuteResult result;
   switch (statement->type) {
     case STATEMENT_INSERT:
-      return execute_insert(statement, table);
+      result = execute_insert(statement, table);
+      latency_record(&stats->insert, start);
+      return result;
     case STATEMENT_SELECT:
-      return execute_select(statement, table);
+      result = execute_select(statement, table, sink);
+      latency_record(&stats->select, start);
+      return result;
+    case STATEMENT_SELECT_KEY:
+      result = execute_select_key(statement, table, sink);
+      latency_record(&stats->select, start);
+      return result;
+    case STATEMENT_DELETE:
+      return table_delete(table, statement->range_start);
+    case STATEMENT_UPDATE:
+      return table_update(table, &statement->row_to_insert);
+    case STATEMENT_AGGREGATE:
+      result = execute_aggregate(statement, table, sink);
+      latency_record(&stats->select, start);
+      return result;
+    case STATEMENT_CREATE_INDEX:
+      return table_create_index(table, statement->column);
   }
 }
 
-// this method is the driver method
-int main(int argc, char *argv[]) {
-  // we allocate an input buffer
-  if (argc < 2) {
-    printf("Must supply a database filename.\n");
-    exit(EXIT_FAILURE);
+// makes room for extra more bytes at the end of buffer
+void byte_buffer_reserve(ByteBuffer *buffer, size_t extra) {
+  if (buffer->length + extra > buffer->capacity) {
+    buffer->capacity = 2 * buffer->capacity + extra;
+    buffer->data = realloc(buffer->data, buffer->capacity);
   }
+}
 
-  char *filename = argv[1];
-  Table *table = db_open(filename);
+void byte_buffer_append(ByteBuffer *buffer, void *data, size_t length) {
+  byte_buffer_reserve(buffer, length);
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+}
 
-  InputBuffer *input_buffer = new_input_buffer();
+void byte_buffer_append_row(ByteBuffer *buffer, Row *row) {
+  uint32_t size = serialized_row_size(row);
+  byte_buffer_reserve(buffer, size);
+  serialize_row(row, buffer->data + buffer->length);
+  buffer->length += size;
+}
 
-  // the REPL starting point
-  while (true) {
-    print_prompt();
-    // we read the input
-    read_input(input_buffer);
+void send_scanned_row(Row *row, void *argument) {
+  byte_buffer_append_row(argument, row);
+}
+
+// reads a serialized row out of a request. returns the bytes it took,
+// or 0 if it is cut off or does not fit the schema
+uint32_t decode_row(uint8_t *source, uint32_t length, Row *row) {
+  uint32_t username_end = ID_SIZE + LEAF_NODE_LENGTH_SIZE;
+  if (length < username_end) {
+    return 0;
+  }
+  uint8_t username_length = source[ID_SIZE];
+  uint32_t email_end = username_end + username_length + LEAF_NODE_LENGTH_SIZE;
+  if (username_length > COLUMN_USERNAME_SIZE || length < email_end) {
+    return 0;
+  }
+  uint8_t email_length = source[email_end - LEAF_NODE_LENGTH_SIZE];
+  if (length < email_end + email_length) {
+    return 0;
+  }
+  deserialize_row(source, row);
+  // the strings are kept nul terminated, they can not hold a nul
+  if (strlen(row->username) != username_length ||
+      strlen(row->email) != email_length) {
+    return 0;
+  }
+  return email_end + email_length;
+}
 
-    // we process meta commands in this section
-    if (input_buffer->buffer[0] == '.') {
-      switch (do_meta_command(input_buffer, table)) {
-        case META_COMMAND_SUCCESS:
-          continue;
-        case META_COMMAND_UNRECOGNIZED_COMMAND:
-          printf("Unrecognized command '%s'.\n", input_buffer->buffer);
-          continue;
+// runs the request in body and appends the response frame to output
+void server_handle_request(Table *table, uint8_t *body, uint32_t length,
+                           ByteBuffer *output) {
+  uint64_t start = stats_now();
+  size_t frame_start = output->length;
+  uint32_t frame_length = 0;
+  uint8_t status = RESPONSE_BAD_REQUEST;
+  byte_buffer_append(output, &frame_length, sizeof(uint32_t));
+  byte_buffer_append(output, &status, sizeof(uint8_t));
+
+  uint32_t key = 0;
+  if (length == 1 + sizeof(uint32_t)) {
+    memcpy(&key, body + 1, sizeof(uint32_t));
+  }
+  switch (length > 0 ? body[0] : 0) {
+    case REQUEST_INSERT: {
+      uint32_t num_rows = 0;
+      if (length > 1 + sizeof(uint32_t)) {
+        memcpy(&num_rows, body + 1, sizeof(uint32_t));
+      }
+      // every row takes at least an id and two length bytes, which
+      // bounds what a broken count makes us allocate
+      uint32_t offset = 1 + sizeof(uint32_t);
+      uint32_t min_row_size = ID_SIZE + 2 * LEAF_NODE_LENGTH_SIZE;
+      if (num_rows == 0 || num_rows > (length - offset) / min_row_size) {
+        break;
+      }
+      Row *rows = malloc(num_rows * sizeof(Row));
+      uint32_t num_decoded = 0;
+      while (num_decoded < num_rows) {
+        uint32_t size =
+            decode_row(body + offset, length - offset, &rows[num_decoded]);
+        if (size == 0) {
+          break;
+        }
+        offset += size;
+        num_decoded++;
+      }
+      if (num_decoded == num_rows && offset == length) {
+        status = num_rows == 1 ? table_insert(table, rows)
+                               : table_insert_rows(table, rows, num_rows);
+      }
+      free(rows);
+      break;
+    }
+    case REQUEST_GET: {
+      Row row;
+      if (length != 1 + sizeof(uint32_t)) {
+        break;
+      }
+      status = EXECUTE_KEY_NOT_FOUND;
+      if (table_get(table, key, &row)) {
+        status = EXECUTE_SUCCESS;
+        byte_buffer_append_row(output, &row);
+      }
+      break;
+    }
+    case REQUEST_SCAN: {
+      uint32_t range[2];
+      if (length != 1 + sizeof(range)) {
+        break;
+      }
+      memcpy(range, body + 1, sizeof(range));
+      size_t count_offset = output->length;
+      uint32_t num_rows = 0;
+      byte_buffer_append(output, &num_rows, sizeof(uint32_t));
+      num_rows =
+          table_scan(table, range[0], range[1], send_scanned_row, output);
+      memcpy(output->data + count_offset, &num_rows, sizeof(uint32_t));
+      status = EXECUTE_SUCCESS;
+      break;
+    }
+    case REQUEST_DELETE:
+      if (length == 1 + sizeof(uint32_t)) {
+        status = table_delete(table, key);
       }
+      break;
+    case REQUEST_UPDATE: {
+      Row row;
+      if (length > 1 && decode_row(body + 1, length - 1, &row) == length - 1) {
+        status = table_update(table, &row);
+      }
+      break;
+    }
+  }
+
+  frame_length = output->length - frame_start - sizeof(uint32_t);
+  memcpy(output->data + frame_start, &frame_length, sizeof(uint32_t));
+  output->data[frame_start + sizeof(uint32_t)] = status;
+
+  // requests go into the same latency stats as the statements
+  uint8_t type = length > 0 ? body[0] : 0;
+  if (type == REQUEST_INSERT) {
+    latency_record(&table->pager->stats.insert, start);
+  } else if (type == REQUEST_GET || type == REQUEST_SCAN) {
+    latency_record(&table->pager->stats.select, start);
+  }
+}
+
+// sends as much of the pending output as the socket takes. returns false
+// if the connection broke
+bool connection_flush(Connection *connection) {
+  ByteBuffer *output = &connection->output;
+  while (connection->output_sent < output->length) {
+    ssize_t sent = send(connection->fd, output->data + connection->output_sent,
+                        output->length - connection->output_sent, MSG_NOSIGNAL);
+    if (sent < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    connection->output_sent += sent;
+  }
+  output->length = 0;
+  connection->output_sent = 0;
+  return true;
+}
+
+// answers the complete requests at the front of input in order, until
+// the answers pass SERVER_MAX_OUTPUT. returns false if the client sent
+// a frame we do not take
+bool connection_answer(Table *table, Connection *connection) {
+  ByteBuffer *input = &connection->input;
+  size_t offset = 0;
+  while (connection->output.length < SERVER_MAX_OUTPUT &&
+         input->length - offset >= sizeof(uint32_t)) {
+    uint32_t length;
+    memcpy(&length, input->data + offset, sizeof(uint32_t));
+    if (length > SERVER_MAX_FRAME) {
+      return false;
+    }
+    if (input->length - offset < sizeof(uint32_t) + length) {
+      break;
+    }
+    server_handle_request(table, input->data + offset + sizeof(uint32_t),
+                          length, &connection->output);
+    offset += sizeof(uint32_t) + length;
+  }
+  if (offset > 0) {
+    memmove(input->data, input->data + offset, input->length - offset);
+    input->length -= offset;
+  }
+  return true;
+}
+
+// sends the pending answers. once they are all out the requests that
+// waited in input are answered and sent in turn, until a send would
+// block or input holds no complete request. returns false if the
+// connection broke
+bool connection_write(Table *table, Connection *connection) {
+  while (connection_flush(connection)) {
+    size_t pending = connection->input.length;
+    if (connection->output.length > 0) {
+      return true;
+    }
+    if (!connection_answer(table, connection)) {
+      return false;
     }
+    if (connection->input.length == pending) {
+      return true;
+    }
+  }
+  return false;
+}
 
-    // we process actual SQL queries here
-    Statement statement;
-    switch (prepare_statement(input_buffer, &statement)) {
-      case PREPARE_SUCCESS:
+// reads what the client sent, answering the complete requests after
+// every read. it stops after SERVER_READ_BUDGET bytes or once the
+// answers pass SERVER_MAX_OUTPUT, epoll is level triggered and wakes us
+// up again for the rest. returns false once the client is gone or sent
+// a frame we do not take
+bool connection_read(Table *table, Connection *connection) {
+  ByteBuffer *input = &connection->input;
+  size_t budget = SERVER_READ_BUDGET;
+  while (budget > 0 && connection->output.length < SERVER_MAX_OUTPUT) {
+    size_t size = budget < SERVER_READ_SIZE ? budget : SERVER_READ_SIZE;
+    byte_buffer_reserve(input, size);
+    ssize_t received =
+        recv(connection->fd, input->data + input->length, size, 0);
+    if (received == 0) {
+      return false;
+    }
+    if (received < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
         break;
-      case PREPARE_STRING_TOO_LONG:
-        printf("String is too long.\n");
+      }
+      if (errno == EINTR) {
         continue;
-      case PREPARE_NEGATIVE_ID:
-        printf("ID must be positive.\n");
+      }
+      return false;
+    }
+    input->length += received;
+    budget -= received;
+    if (!connection_answer(table, connection)) {
+      return false;
+    }
+  }
+  return connection_write(table, connection);
+}
+
+void connection_close(int epoll_fd, Connection *connection) {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+  close(connection->fd);
+  free(connection->input.data);
+  free(connection->output.data);
+  free(connection);
+}
+
+// listens on the loopback tcp port when address is a number and on the
+// unix socket at that path otherwise
+int server_listen(char *address, bool *tcp) {
+  *tcp = address[0] != '\0' && strspn(address, "0123456789") == strlen(address);
+  int fd = socket(*tcp ? AF_INET : AF_UNIX,
+                  SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    printf("Error creating socket: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+
+  int result;
+  if (*tcp) {
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in in_address = {0};
+    in_address.sin_family = AF_INET;
+    in_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    in_address.sin_port = htons(atoi(address));
+    result = bind(fd, (struct sockaddr *)&in_address, sizeof(in_address));
+  } else {
+    struct sockaddr_un un_address = {0};
+    un_address.sun_family = AF_UNIX;
+    if (strlen(address) >= sizeof(un_address.sun_path)) {
+      printf("The socket path is too long.\n");
+      exit(EXIT_FAILURE);
+    }
+    strcpy(un_address.sun_path, address);
+    // a socket file left behind by an earlier server is in the way
+    unlink(address);
+    result = bind(fd, (struct sockaddr *)&un_address, sizeof(un_address));
+  }
+  if (result < 0 || listen(fd, SOMAXCONN) < 0) {
+    printf("Error listening on '%s': %d\n", address, errno);
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+volatile sig_atomic_t server_stopping = 0;
+
+void server_stop(int signal_number) {
+  (void)signal_number;
+  server_stopping = 1;
+}
+
+// the server front end, an epoll loop on a single thread which serves
+// the clients until SIGINT or SIGTERM. the signals are only let through
+// while the loop waits, so one can not slip in before the wait starts
+void server_run(Table *table, char *address) {
+  bool tcp;
+  int listen_fd = server_listen(address, &tcp);
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  // the listening socket is the event without a connection
+  event.data.ptr = NULL;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+  sigset_t stop_signals;
+  sigset_t wait_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &stop_signals, &wait_signals);
+  sigdelset(&wait_signals, SIGINT);
+  sigdelset(&wait_signals, SIGTERM);
+  struct sigaction action = {0};
+  action.sa_handler = server_stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  printf("Listening on %s.\n", address);
+  fflush(stdout);
+
+  struct epoll_event events[SERVER_MAX_EVENTS];
+  while (!server_stopping) {
+    int num_events = epoll_pwait(epoll_fd, events, SERVER_MAX_EVENTS, -1,
+                                 &wait_signals);
+    if (num_events < 0) {
+      if (errno == EINTR) {
         continue;
-      case PREPARE_SYNTAX_ERROR:
-        printf("Syntax error. Could not parse statement.\n");
+      }
+      printf("Error waiting for events: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < num_events; i++) {
+      Connection *connection = events[i].data.ptr;
+      if (connection == NULL) {
+        int fd;
+        while ((fd = accept4(listen_fd, NULL, NULL,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+          // answers are sent as soon as a batch is done, not held back
+          int no_delay = 1;
+          if (tcp) {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay,
+                       sizeof(no_delay));
+          }
+          connection = calloc(1, sizeof(Connection));
+          connection->fd = fd;
+          event.events = EPOLLIN;
+          event.data.ptr = connection;
+          epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        }
         continue;
-      case PREPARE_UNRECOGNIZED_STATEMENT:
-        printf("Unrecognized keyword at start of '%s'.\n",
-               input_buffer->buffer);
+      }
+
+      // a client that does not take its answers is not read from until
+      // it does, so its pending output can not grow without bound
+      bool open = events[i].events & EPOLLOUT
+                      ? connection_write(table, connection)
+                      : connection_read(table, connection);
+      if (!open) {
+        connection_close(epoll_fd, connection);
         continue;
+      }
+      uint32_t wanted = connection->output.length > 0 ? EPOLLOUT : EPOLLIN;
+      if (wanted != (events[i].events & (EPOLLIN | EPOLLOUT))) {
+        event.events = wanted;
+        event.data.ptr = connection;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+      }
     }
+  }
 
-    // we execute actual queries here
-    switch (execute_statement(&statement, table)) {
-      case EXECUTE_SUCCESS:
-        printf("Executed.\n");
-        break;
-      case (EXECUTE_DUPLICATE_KEY):
-        printf("Error: Duplicate key.\n");
-        break;
-      case EXECUTE_TABLE_FULL:
-        printf("Error: Table full.\n");
-        break;
-    }
+  close(epoll_fd);
+  close(listen_fd);
+  if (!tcp) {
+    unlink(address);
   }
 }
@@ -0,0 +1,158 @@
+#ifndef DB_H
+#define DB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// the interface of the database engine in db.c. the REPL in main.c and
+// the benchmark in bench.c are both built on top of it
+
+// struct which holds the bytes read from stdin,
+// the length of buffer and input length
+typedef struct {
+  char *buffer;
+  size_t buffer_length;
+  ssize_t input_length;
+} InputBuffer;
+
+// defines types for statement execution
+typedef enum {
+  EXECUTE_SUCCESS,
+  EXECUTE_TABLE_FULL,
+  EXECUTE_DUPLICATE_KEY,
+  EXECUTE_KEY_NOT_FOUND,
+  EXECUTE_INDEX_EXISTS
+} ExecuteResult;
+
+// defines types for meta command
+typedef enum {
+  META_COMMAND_SUCCESS,
+  META_COMMAND_UNRECOGNIZED_COMMAND
+} MetaCommandResult;
+
+// defines types for statement commands
+typedef enum {
+  PREPARE_SUCCESS,
+  PREPARE_SYNTAX_ERROR,
+  PREPARE_UNRECOGNIZED_STATEMENT,
+  PREPARE_STRING_TOO_LONG,
+  PREPARE_NEGATIVE_ID
+} PrepareResult;
+
+// defines types for statements, will grow over time
+typedef enum {
+  STATEMENT_INSERT,
+  STATEMENT_SELECT,
+  STATEMENT_SELECT_KEY,
+  STATEMENT_DELETE,
+  STATEMENT_UPDATE,
+  STATEMENT_AGGREGATE,
+  STATEMENT_CREATE_INDEX
+} StatementType;
+
+// aggregates a select can compute over the rows it matches
+typedef enum { AGGREGATE_COUNT, AGGREGATE_MIN_ID, AGGREGATE_MAX_ID } Aggregate;
+
+#define MAX_AGGREGATES 8
+
+// constant for schema
+#define COLUMN_USERNAME_SIZE 32
+#define COLUMN_EMAIL_SIZE 255
+
+// fixed row schema
+typedef struct {
+  uint32_t id;
+  char username[COLUMN_USERNAME_SIZE + 1];
+  char email[COLUMN_EMAIL_SIZE + 1];
+} Row;
+
+// the string columns of a row, which a select can filter on and an
+// index can be created for
+typedef enum { COLUMN_USERNAME, COLUMN_EMAIL } StringColumn;
+
+#define NUM_STRING_COLUMNS 2
+
+// creating a statement dict to keep track of types.
+// an insert holds num_rows rows, a single row lives in row_to_insert and
+// rows points at it, larger batches are allocated. an update keeps the
+// new row in row_to_insert.
+// a select returns the rows whose id lies in [range_start, range_end],
+// a delete removes the row with id range_start.
+// with filter set a select only takes rows whose column holds value,
+// an aggregate select computes its aggregates over the rows it takes.
+// a create index builds the index of column
+typedef struct {
+  StatementType type;
+  Row row_to_insert;
+  Row *rows;
+  uint32_t num_rows;
+  uint32_t range_start;
+  uint32_t range_end;
+  bool filter;
+  StringColumn column;
+  char value[COLUMN_EMAIL_SIZE + 1];
+  Aggregate aggregates[MAX_AGGREGATES];
+  uint32_t num_aggregates;
+} Statement;
+
+// tunables picked on the command line and handed to db_open.
+// a checkpoint limit of 0 disables that automatic checkpoint trigger.
+// with stats_filename set the stats are appended to that file as a line
+// of json every stats_interval seconds and once more on close
+typedef struct {
+  uint32_t pool_frames;
+  uint32_t checkpoint_pages;
+  uint32_t checkpoint_seconds;
+  bool wal;
+  uint32_t group_commit;
+  bool use_mmap;
+  uint32_t fill_percent;
+  bool compress;
+  uint32_t page_size;
+  uint32_t read_ahead_pages;
+  uint32_t scan_threads;
+  char *stats_filename;
+  uint32_t stats_interval;
+} DbOptions;
+
+// an open database, and where select writes the rows it returns
+typedef struct Table Table;
+typedef struct ResultSink ResultSink;
+
+typedef void (*RowCallback)(Row *row, void *argument);
+
+// opening and closing a database. db_open checks the options first and
+// exits with a message when they can not be used
+void db_default_options(DbOptions *options);
+Table *db_open(const char *filename, DbOptions *options);
+void db_close(Table *table);
+
+// row access without going through statements
+ExecuteResult table_insert(Table *table, Row *row);
+ExecuteResult table_insert_rows(Table *table, Row *rows, uint32_t num_rows);
+ExecuteResult table_update(Table *table, Row *row);
+ExecuteResult table_delete(Table *table, uint32_t key);
+bool table_get(Table *table, uint32_t key, Row *row);
+uint32_t table_scan(Table *table, uint32_t start, uint32_t end,
+                    RowCallback callback, void *argument);
+
+// the statements and meta commands the REPL reads
+InputBuffer *new_input_buffer();
+void close_input_buffer(InputBuffer *input_buffer);
+void print_prompt();
+void read_input(InputBuffer *input_buffer);
+ResultSink *new_result_sink();
+MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table,
+                                  ResultSink *sink);
+PrepareResult prepare_statement(InputBuffer *input_buffer,
+                                Statement *statement);
+ExecuteResult execute_statement(Statement *statement, Table *table,
+                                ResultSink *sink);
+void free_statement(Statement *statement);
+
+// the loader and the socket server
+void load_file(Table *table, const char *filename, bool binary);
+void server_run(Table *table, char *address);
+
+#endif
@@ -0,0 +1,139 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db.h"
+
+// this method is the driver method
+int main(int argc, char *argv[]) {
+  // we allocate an input buffer
+  if (argc < 2) {
+    printf("Must supply a database filename.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  char *filename = argv[1];
+
+  // the remaining arguments are optional --name value pairs
+  DbOptions options;
+  db_default_options(&options);
+  char *load_filename = NULL;
+  bool load_binary = false;
+  char *listen_address = NULL;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--frames") == 0) {
+      options.pool_frames = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--checkpoint-pages") == 0) {
+      options.checkpoint_pages = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--checkpoint-seconds") == 0) {
+      options.checkpoint_seconds = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--wal") == 0) {
+      options.wal = strcmp(argv[i + 1], "on") == 0;
+    } else if (strcmp(argv[i], "--fill-factor") == 0) {
+      options.fill_percent = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--load") == 0) {
+      load_filename = argv[i + 1];
+    } else if (strcmp(argv[i], "--load-format") == 0) {
+      load_binary = strcmp(argv[i + 1], "binary") == 0;
+    } else if (strcmp(argv[i], "--pager") == 0) {
+      options.use_mmap = strcmp(argv[i + 1], "mmap") == 0;
+    } else if (strcmp(argv[i], "--compress") == 0) {
+      options.compress = strcmp(argv[i + 1], "on") == 0;
+    } else if (strcmp(argv[i], "--read-ahead") == 0) {
+      options.read_ahead_pages = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--page-size") == 0) {
+      options.page_size = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--group-commit") == 0) {
+      options.group_commit = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--scan-threads") == 0) {
+      options.scan_threads = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--stats-file") == 0) {
+      options.stats_filename = argv[i + 1];
+    } else if (strcmp(argv[i], "--stats-interval") == 0) {
+      options.stats_interval = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--listen") == 0) {
+      listen_address = argv[i + 1];
+    } else {
+      printf("Unknown option '%s'.\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  Table *table = db_open(filename, &options);
+
+  // loader mode, the file is loaded without starting the REPL
+  if (load_filename != NULL) {
+    load_file(table, load_filename, load_binary);
+    db_close(table);
+    exit(EXIT_SUCCESS);
+  }
+
+  // server mode, clients talk to the table over a socket instead
+  if (listen_address != NULL) {
+    server_run(table, listen_address);
+    db_close(table);
+    exit(EXIT_SUCCESS);
+  }
+
+  InputBuffer *input_buffer = new_input_buffer();
+  ResultSink *sink = new_result_sink();
+
+  // the REPL starting point
+  while (true) {
+    print_prompt();
+    // we read the input
+    read_input(input_buffer);
+
+    // we process meta commands in this section
+    if (input_buffer->buffer[0] == '.') {
+      switch (do_meta_command(input_buffer, table, sink)) {
+        case META_COMMAND_SUCCESS:
+          continue;
+        case META_COMMAND_UNRECOGNIZED_COMMAND:
+          printf("Unrecognized command '%s'.\n", input_buffer->buffer);
+          continue;
+      }
+    }
+
+    // we process actual SQL queries here
+    Statement statement;
+    switch (prepare_statement(input_buffer, &statement)) {
+      case PREPARE_SUCCESS:
+        break;
+      case PREPARE_STRING_TOO_LONG:
+        printf("String is too long.\n");
+        continue;
+      case PREPARE_NEGATIVE_ID:
+        printf("ID must be positive.\n");
+        continue;
+      case PREPARE_SYNTAX_ERROR:
+        printf("Syntax error. Could not parse statement.\n");
+        continue;
+      case PREPARE_UNRECOGNIZED_STATEMENT:
+        printf("Unrecognized keyword at start of '%s'.\n",
+               input_buffer->buffer);
+        continue;
+    }
+
+    // we execute actual queries here
+    switch (execute_statement(&statement, table, sink)) {
+      case EXECUTE_SUCCESS:
+        printf("Executed.\n");
+        break;
+      case (EXECUTE_DUPLICATE_KEY):
+        printf("Error: Duplicate key.\n");
+        break;
+      case EXECUTE_TABLE_FULL:
+        printf("Error: Table full.\n");
+        break;
+      case EXECUTE_KEY_NOT_FOUND:
+        printf("Error: Key not found.\n");
+        break;
+      case EXECUTE_INDEX_EXISTS:
+        printf("Error: Index already exists.\n");
+        break;
+    }
+    free_statement(&statement);
+  }
+}
@@ -1,11 +1,14 @@
+require "json"
+require "socket"
+
 describe 'database' do
     before do
-        `rm -rf test.db`
+        `rm -rf test.db test.db-wal test.sock test.stats`
     end
 
-    def run_script(commands)
+    def run_script(commands, options = "")
         raw_output = nil
-        IO.popen("./bin/db test.db", "r+") do |pipe|
+        IO.popen("./bin/db test.db #{options}", "r+") do |pipe|
             commands.each do |command|
                 pipe.puts command
             end
@@ -18,6 +21,23 @@ describe 'database' do
         raw_output.split("\n")
     end
 
+    # a row with both strings at their longest takes as much space in a
+    # leaf as any row can, 13 of them fill a leaf
+    def insert_wide_row(i)
+        "insert #{i} #{'u' * 32} #{'e' * 255}"
+    end
+
+    # a request or response of the socket server is framed by its length
+    def frame(body)
+        [body.bytesize].pack("V") + body
+    end
+
+    # a row as the socket server reads and writes it
+    def row(id, username, email)
+        [id, username.bytesize].pack("VC") + username +
+            [email.bytesize].pack("C") + email
+    end
+
     it 'inserts and retrieves a row' do
         result = run_script([
             "insert 1 user1 abcd@vishu.com",
@@ -56,13 +76,13 @@ describe 'database' do
         ])
     end
     
-    it 'prints error when table is full' do
+    it 'keeps inserting past the size of a single leaf' do
         script = (1..1401).map do |i|
             "insert #{i} user#{i} person#{i}@example.com"
         end
         script << ".exit"
         result = run_script(script)
-        expect(result[-2]).to eq('db > Error: Table full.')
+        expect(result[-2]).to eq('db > Executed.')
     end
 
     it 'prints error if the string is too long' do
@@ -111,10 +131,10 @@ describe 'database' do
             "db > Constants:",
             "ROW_SIZE: 293",
             "COMMON_NODE_HEADER_SIZE: 6",
-            "LEAF_NODE_HEADER_SIZE: 10",
-            "LEAF_NODE_CELL_SIZE: 297",
-            "LEAF_NODE_SPACE_FOR_CELLS: 4086",
-            "LEAF_NODE_MAX_CELLS: 13",
+            "LEAF_NODE_HEADER_SIZE: 22",
+            "LEAF_NODE_SLOT_SIZE: 6",
+            "LEAF_NODE_MAX_CELL_SIZE: 289",
+            "LEAF_NODE_SPACE_FOR_CELLS: 4074",
             "db > "
         ])
 
@@ -160,10 +180,10 @@ describe 'database' do
 
     it 'allows printing out the structure of a 3-leaf-node btree' do
           script = (1..14).map do |i|
-            "insert #{i} user#{i} person#{i}@example.com"
+            insert_wide_row(i)
           end
           script << ".btree"
-          script << "insert 15 user15 person15@example.com"
+          script << insert_wide_row(15)
           script << ".exit"
           result = run_script(script)
 
@@ -187,8 +207,705 @@ describe 'database' do
             "    - 12",
             "    - 13",
             "    - 14",
-            "db > Need to implement searching an internal node",
+            "db > Executed.",
+            "db > ",
           ])
         end
 
-end
\ No newline at end of file
+    it 'splits internal nodes once the root runs out of keys' do
+        script = (1..4000).map do |i|
+            insert_wide_row(i)
+        end
+        script << ".btree"
+        script += [1, 2000, 3577, 4000].map do |i|
+            insert_wide_row(i)
+        end
+        script << ".exit"
+        result = run_script(script, "--frames 8")
+
+        expect(result[4000...4003]).to eq([
+            "db > Tree:",
+            "- internal (size 1)",
+            "  - internal (size 255)",
+        ])
+        expect(result.count("  - internal (size 255)")).to eq(1)
+        expect(result[-5...(result.length)]).to eq([
+            "db > Error: Duplicate key.",
+            "db > Error: Duplicate key.",
+            "db > Error: Duplicate key.",
+            "db > Error: Duplicate key.",
+            "db > ",
+        ])
+    end
+
+    it 'keeps checkpointed rows when the session ends without .exit' do
+        result = run_script([
+            "insert 1 user1 person1@example.com",
+            ".checkpoint",
+            ".checkpoint",
+            "insert 2 user2 person2@example.com",
+        ])
+
+        expect(result).to match_array([
+            "db > Executed.",
+            "db > Checkpoint wrote 1 pages.",
+            "db > Checkpoint wrote 0 pages.",
+            "db > Executed.",
+            "db > Error reading input",
+        ])
+
+        result = run_script([
+            "select",
+            ".exit"
+        ])
+
+        expect(result).to match_array([
+            "db > (1, user1, person1@example.com)",
+            "Executed.",
+            "db > "
+        ])
+    end
+
+    it 'replays committed statements from the log after a crash' do
+        result = run_script([
+            "insert 1 user1 person1@example.com",
+            "insert 2 user2 person2@example.com",
+        ], "--wal on --group-commit 4")
+
+        expect(result).to match_array([
+            "db > Executed.",
+            "db > Executed.",
+            "db > Error reading input",
+        ])
+
+        result = run_script([
+            "select",
+            ".exit"
+        ], "--wal on")
+
+        expect(result).to match_array([
+            "db > (1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "Executed.",
+            "db > "
+        ])
+        expect(File.exist?("test.db-wal")).to eq(false)
+    end
+
+    it 'reads rows written by the mmap pager with the buffered pager' do
+        result = run_script([
+            "insert 2 user2 person2@example.com",
+            "insert 1 user1 person1@example.com",
+            ".exit"
+        ], "--pager mmap")
+
+        expect(result).to match_array([
+            "db > Executed.",
+            "db > Executed.",
+            "db > ",
+        ])
+
+        result = run_script([
+            "select",
+            ".exit"
+        ])
+
+        expect(result).to match_array([
+            "db > (1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "Executed.",
+            "db > "
+        ])
+    end
+
+    it 'selects an id range spanning several leaves' do
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << "select where id between 6 and 21"
+        script << "select where id between 40 and 50"
+        script << "select where id between 6"
+        script << ".exit"
+        result = run_script(script)
+
+        expected = ["db > (6, user6, person6@example.com)"]
+        expected += (7..21).map do |i|
+            "(#{i}, user#{i}, person#{i}@example.com)"
+        end
+        expected += [
+            "Executed.",
+            "db > Executed.",
+            "db > Syntax error. Could not parse statement.",
+            "db > ",
+        ]
+        expect(result[30...(result.length)]).to eq(expected)
+    end
+
+    it 'selects every row of a multi-leaf table in order' do
+        script = (1..50).to_a.shuffle(random: Random.new(7)).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << "select"
+        script << ".exit"
+        result = run_script(script)
+
+        expected = ["db > (1, user1, person1@example.com)"]
+        expected += (2..50).map do |i|
+            "(#{i}, user#{i}, person#{i}@example.com)"
+        end
+        expected += ["Executed.", "db > "]
+        expect(result[50...(result.length)]).to eq(expected)
+    end
+
+    it 'selects a single row by id' do
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << "select 17"
+        script << "select 31"
+        script << "select -4"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result[30...(result.length)]).to eq([
+            "db > (17, user17, person17@example.com)",
+            "Executed.",
+            "db > Error: Key not found.",
+            "db > ID must be positive.",
+            "db > ",
+        ])
+    end
+
+    it 'bulk loads a csv file into packed leaves' do
+        rows = (1..40).to_a.reverse.map do |i|
+            "#{i},#{'u' * 32},#{'e' * 255}"
+        end
+        File.write("test.csv", rows.join("\n") + "\n")
+
+        result = run_script([
+            ".load test.csv",
+            ".btree",
+            "select 40",
+            ".exit"
+        ], "--fill-factor 70")
+        File.delete("test.csv")
+
+        expect(result[0...4]).to eq([
+            "db > Loaded 40 rows.",
+            "db > Tree:",
+            "- internal (size 4)",
+            "  - leaf (size 8)",
+        ])
+        expect(result.count { |line| line.end_with?("- leaf (size 8)") }).to eq(5)
+        expect(result[-3...(result.length)]).to eq([
+            "db > (40, #{'u' * 32}, #{'e' * 255})",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'reuses and truncates the pages of a failed bulk load' do
+        rows = (1..40).map { |i| "#{i},#{'u' * 32},#{'e' * 255}" }
+        File.write("test.csv", (rows + ["40,u,e"]).join("\n") + "\n")
+        result = run_script([
+            ".load test.csv",
+            ".truncate",
+            ".exit"
+        ])
+        expect(result[0...2]).to eq([
+            "db > Error: Duplicate key.",
+            "db > Truncate removed 4 pages.",
+        ])
+        expect(File.size("test.db")).to eq(2 * 4096)
+
+        # the pages of the failed load are reused, so the file only holds
+        # the header, the root and four leaves
+        `rm -rf test.db`
+        run_script([".load test.csv", ".exit"])
+        File.write("test.csv", rows.join("\n") + "\n")
+        result = run_script([
+            ".load test.csv",
+            "select 40",
+            ".exit"
+        ])
+        File.delete("test.csv")
+        expect(result[0...2]).to eq([
+            "db > Loaded 40 rows.",
+            "db > (40, #{'u' * 32}, #{'e' * 255})",
+        ])
+        expect(File.size("test.db")).to eq(6 * 4096)
+    end
+
+    it 'leaves the table empty when a load that fits one leaf fails' do
+        File.write("test.csv", "1,a,a@x\n2,b,b@x\n2,c,c@x\n")
+        result = run_script([".load test.csv", "select", ".exit"])
+        expect(result).to eq([
+            "db > Error: Duplicate key.",
+            "db > Executed.",
+            "db > ",
+        ])
+
+        # nothing of the failed load reaches the file either
+        result = run_script(["insert 3 c c@x", ".exit"])
+        result = run_script(["select", ".exit"])
+        File.delete("test.csv")
+        expect(result).to eq([
+            "db > (3, c, c@x)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'reads quoted csv fields and rejects malformed rows' do
+        File.write("test.csv",
+                   "1,a,b\r\n2,\"x,y\",\"said \"\"hi\"\"\nthen\"\n" \
+                   "4294967295,u,e")
+        bad_rows = [
+            "4294967297,u,e\n",
+            "2,x,y,z\n",
+            "2,,y\n",
+            "2,x\n",
+            "2,\"x\n",
+            "2,x\"y,z\n",
+            "x2,u,e\n",
+        ]
+        script = [".load test.csv"]
+        bad_rows.each_with_index do |row, i|
+            File.write("bad#{i}.csv", row)
+            script << ".load bad#{i}.csv"
+        end
+        result = run_script(script + ["select", ".exit"])
+        File.delete("test.csv")
+        bad_rows.each_index { |i| File.delete("bad#{i}.csv") }
+
+        expect(result).to eq([
+            "db > Loaded 3 rows.",
+        ] + ["db > Error: Invalid row in load file."] * bad_rows.length + [
+            "db > (1, a, b)",
+            "(2, x,y, said \"hi\"",
+            "then)",
+            "(4294967295, u, e)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'updates and deletes rows and merges underfull leaves' do
+        script = (1..14).map { |i| insert_wide_row(i) }
+        script += [
+            "delete 1",
+            "delete 2",
+            "delete 3",
+            "delete 3",
+            "update 3 a b",
+            "update 5 five five@example.com",
+            ".btree",
+            "select 5",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        expect(result[16...19]).to eq([
+            "db > Executed.",
+            "db > Error: Key not found.",
+            "db > Error: Key not found.",
+        ])
+        expect(result[20...23]).to eq([
+            "db > Tree:",
+            "- leaf (size 11)",
+            "  - 4",
+        ])
+        expect(result[-3...(result.length)]).to eq([
+            "db > (5, five, five@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'inserts many rows in one statement' do
+        batch = (1..40).to_a.shuffle(random: Random.new(3)).map do |i|
+            "#{i} user#{i} person#{i}@example.com"
+        end
+        result = run_script([
+            "insert " + batch.join(" "),
+            "insert 50 user50 person50@example.com 7 user7 person7@example.com",
+            "insert 60 user60",
+            "select",
+            ".exit"
+        ])
+
+        expected = [
+            "db > Executed.",
+            "db > Error: Duplicate key.",
+            "db > Syntax error. Could not parse statement.",
+            "db > (1, user1, person1@example.com)",
+        ]
+        expected += (2..40).map do |i|
+            "(#{i}, user#{i}, person#{i}@example.com)"
+        end
+        expected += ["Executed.", "db > "]
+        expect(result).to eq(expected)
+    end
+
+    it 'stores short rows in as little space as they need' do
+        script = (1..100).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".btree"
+        script << "select 100"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result[100...102]).to eq([
+            "db > Tree:",
+            "- leaf (size 100)",
+        ])
+        expect(result[-3...(result.length)]).to eq([
+            "db > (100, user100, person100@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'reads back a compressed db file without the option' do
+        script = (1..200).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script, "--compress on")
+        compressed_size = File.size("test.db")
+
+        result = run_script([
+            "select 150",
+            ".exit"
+        ])
+        expect(result).to eq([
+            "db > (150, user150, person150@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+        expect(File.binread("test.db", 8)).to eq("DBLZPAGE")
+        expect(compressed_size < 3 * 4096).to eq(true)
+
+        `rm -rf test.db`
+        run_script([".exit"])
+        result = run_script([], "--compress on")
+        expect(result).to eq(["Db file was created without compression."])
+    end
+
+    it 'rejects a db file without a valid header' do
+        File.binwrite("test.db", "x" * 4096)
+        result = run_script([".exit"])
+        expect(result).to eq(["Db file has no valid header. Corrupt file."])
+
+        # a compressed file whose page map holds no page 0 at all
+        header = "DBLZPAGE" + [4096, 0, 0, 0, 4096].pack("VVVVQ<")
+        File.binwrite("test.db", header.ljust(4096, "\0"))
+        result = run_script([".exit"])
+        expect(result).to eq(["Db file has no valid header. Corrupt file."])
+    end
+
+    it 'keeps the page size a db file was created with' do
+        script = (1..40).map { |i| insert_wide_row(i) }
+        script << ".exit"
+        run_script(script, "--page-size 16384")
+
+        result = run_script([
+            ".btree",
+            ".exit"
+        ])
+        expect(result[0...2]).to eq([
+            "db > Tree:",
+            "- leaf (size 40)",
+        ])
+        expect(File.size("test.db")).to eq(2 * 16384)
+
+        result = run_script([], "--page-size 4096")
+        expect(result).to eq(["Db file uses 16384 byte pages."])
+    end
+
+    it 'reads ahead the leaves of a long scan' do
+        script = (1..300).map { |i| insert_wide_row(i) }
+        script << ".exit"
+        run_script(script)
+
+        expected = run_script(["select", ".exit"], "--read-ahead 0")
+        result = run_script(["select", ".exit"], "--read-ahead 4 --frames 16")
+        expect(result.length).to eq(302)
+        expect(result).to eq(expected)
+
+        result = run_script([], "--read-ahead 5000")
+        expect(result).to eq([
+            "The read-ahead window can be at most 1024 pages.",
+        ])
+    end
+
+    it 'exports rows as csv and binary records that load again' do
+        script = (1..30).map { |i| "insert #{i} user#{i} a,\"b\"@#{i}" }
+        script += [
+            ".output test.csv csv",
+            "select where id between 2 and 3",
+            ".output aggregates.csv csv",
+            "select count(*), max(id) where id between 2 and 3",
+            "select min(id) where id between 40 and 50",
+            ".output test.bin binary",
+            "select",
+            ".output stdout",
+            "select 2",
+            ".exit",
+        ]
+        result = run_script(script)
+        expect(result[-3...(result.length)]).to eq([
+            "db > db > (2, user2, a,\"b\"@2)",
+            "Executed.",
+            "db > ",
+        ])
+        expect(File.read("test.csv")).to eq(
+            "2,user2,\"a,\"\"b\"\"@2\"\n3,user3,\"a,\"\"b\"\"@3\"\n"
+        )
+        expect(File.read("aggregates.csv")).to eq("2,3\n\n")
+        expect(File.size("test.bin")).to eq(30 * 293)
+
+        `rm -rf test.db`
+        result = run_script([
+            ".load test.bin binary",
+            "select 30",
+            ".exit"
+        ])
+        expect(result).to eq([
+            "db > Loaded 30 rows.",
+            "db > (30, user30, a,\"b\"@30)",
+            "Executed.",
+            "db > ",
+        ])
+
+        `rm -rf test.db`
+        result = run_script([".load test.csv", "select", ".exit"])
+        File.delete("test.csv", "aggregates.csv", "test.bin")
+        expect(result).to eq([
+            "db > Loaded 2 rows.",
+            "db > (2, user2, a,\"b\"@2)",
+            "(3, user3, a,\"b\"@3)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'aggregates and filters rows on several threads' do
+        # wide enough for the rows to spread over a few leaves
+        email = "x" * 40
+        script = (1..600).map { |i| "insert #{i} user#{i % 3} #{i}@#{email}" }
+        script += [
+            "select count(*), min(id),max(id)",
+            "select max(id),count(*) where username = user2",
+            "select count(*) where id between 10 and 19",
+            "select min(id) where username = nobody",
+            "select where username = user0",
+            ".exit",
+        ]
+        result = run_script(script, "--scan-threads 4 --frames 16")
+        expect(result[600...604]).to eq([
+            "db > (600, 1, 600)",
+            "Executed.",
+            "db > (599, 200)",
+            "Executed.",
+        ])
+        expect(result[604...608]).to eq([
+            "db > (10)",
+            "Executed.",
+            "db > (NULL)",
+            "Executed.",
+        ])
+        expect(result[608...(result.length)]).to eq(
+            ["db > (3, user0, 3@#{email})"] +
+            (2..200).map { |i| "(#{i * 3}, user0, #{i * 3}@#{email})" } +
+            ["Executed.", "db > "]
+        )
+    end
+
+    it 'keeps counting rows across inserts and deletes' do
+        script = (1..100).map { |i| insert_wide_row(i) }
+        script += [
+            "select count(*)",
+            "delete 1",
+            "delete 100",
+            "insert 101 a b 102 c d",
+            "select count(*), min(id), max(id)",
+            "select count(*), min(id) where id between 50 and 59",
+            ".exit",
+        ]
+        result = run_script(script)
+        expect(result[100...(result.length)]).to eq([
+            "db > (100)",
+            "Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > (100, 2, 102)",
+            "Executed.",
+            "db > (10, 50)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'keeps indexes on username and email up to date' do
+        script = (1..100).map do |i|
+            "insert #{i} user#{i % 2} person#{i}@example.com"
+        end
+        script += [
+            "create index on email",
+            "create index on username",
+            "create index on email",
+            "update 7 user0 person7@example.com",
+            "delete 99",
+            "insert 101 user1 person5@example.com",
+            ".exit",
+        ]
+        result = run_script(script)
+        expect(result[100...(result.length)]).to eq([
+            "db > Executed.",
+            "db > Executed.",
+            "db > Error: Index already exists.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > ",
+        ])
+
+        result = run_script([
+            "select where email = person5@example.com",
+            "select count(*), min(id), max(id) where username = user1",
+            "select count(*) where username = user0",
+            "select where username = user1 where",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > (5, user1, person5@example.com)",
+            "(101, user1, person5@example.com)",
+            "Executed.",
+            "db > (49, 1, 101)",
+            "Executed.",
+            "db > (51)",
+            "Executed.",
+            "db > Syntax error. Could not parse statement.",
+            "db > ",
+        ])
+    end
+
+    it 'keeps the ids of a value after other entries of it empty out' do
+        # more ids than one index entry holds, spread over several slots
+        script = ["create index on username"]
+        script += (1..200).map { |i| "insert #{i} user0 #{i}@x" }
+        script += (1..150).map { |i| "delete #{i}" }
+        script += ["insert 1 user0 1@x", ".exit"]
+        run_script(script)
+
+        result = run_script([
+            "select count(*), min(id), max(id) where username = user0",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > (51, 1, 200)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'answers pipelined requests over a unix socket' do
+        IO.popen("./bin/db test.db --listen test.sock", "r") do |server|
+            socket = nil
+            responses = nil
+            begin
+                expect(server.gets).to eq("Listening on test.sock.\n")
+                socket = UNIXSocket.new("test.sock")
+                socket.write([
+                    frame([1, 2].pack("CV") + row(2, "b", "b@x") +
+                          row(1, "a", "a@x")),
+                    frame([1, 1].pack("CV") + row(1, "a", "a@x")),
+                    frame([5].pack("C") + row(2, "bb", "bb@x")),
+                    frame([2, 2].pack("CV")),
+                    frame([4, 1].pack("CV")),
+                    frame([2, 1].pack("CV")),
+                    frame([3, 0, 10].pack("CVV")),
+                    frame([9].pack("C")),
+                ].join)
+
+                responses = 8.times.map do
+                    socket.read(socket.read(4).unpack1("V"))
+                end
+            ensure
+                socket.close if socket
+                Process.kill("TERM", server.pid)
+            end
+
+            expect(responses).to eq([
+                "\x00",
+                "\x02",
+                "\x00",
+                "\x00" + row(2, "bb", "bb@x"),
+                "\x00",
+                "\x03",
+                "\x00" + [1].pack("V") + row(2, "bb", "bb@x"),
+                "\xff".b,
+            ].map(&:b))
+        end
+
+        result = run_script(["select", ".exit"])
+        expect(result).to eq(["db > (2, bb, bb@x)", "Executed.", "db > "])
+    end
+
+    it 'reports runtime stats and dumps them to a file' do
+        script = (1..14).map { |i| insert_wide_row(i) }
+        script << "select 1"
+        script << ".stats"
+        script << ".exit"
+        result = run_script(script, "--stats-file test.stats")
+        stats = result.drop(16).map { |line| line.delete_prefix("db > ") }
+            .take(16).to_h { |line| line.split(": ", 2) }
+
+        expect(stats.values_at("leaf_splits", "internal_splits",
+                               "tree_height", "leaf_pages",
+                               "internal_pages")).to eq(["1", "0", "2", "2", "1"])
+        expect(stats["insert_latency"].start_with?("count 14,")).to eq(true)
+        expect(stats["select_latency"].start_with?("count 1,")).to eq(true)
+
+        # the last dump is written when the database is closed
+        dump = JSON.parse(File.readlines("test.stats").last)
+        expect(dump["leaf_splits"]).to eq(1)
+        expect(dump["insert_latency"]["count"]).to eq(14)
+        expect(dump["page_hits"] > 0).to eq(true)
+
+        # the splits and the shape are those of the table, an index that
+        # splits as well leaves them alone
+        rows = (1..40).map { |i| "insert #{i} user#{i} #{'e' * 250}#{i}" }
+        counters = /^(leaf_splits|internal_splits|tree_height|leaf_pages|internal_pages):/
+        reports = [[], ["create index on email"]].map do |create|
+            `rm -rf test.db`
+            result = run_script(create + rows + [".stats", ".exit"])
+            result.map { |line| line.delete_prefix("db > ") }
+                .select { |line| line.match?(counters) }
+        end
+        expect(reports[1]).to eq(reports[0])
+    end
+
+    it 'benchmarks the engine and reports every workload as json' do
+        report = JSON.parse(`./bin/bench --rows 2000 --scans 2 --file test.db`)
+
+        expect(report["rows"]).to eq(2000)
+        expect(report["workloads"].map { |workload| workload["name"] }).to eq([
+            "insert_sequential",
+            "insert_random",
+            "lookup_cold",
+            "lookup_warm",
+            "scan_cold",
+            "scan_warm",
+        ])
+        report["workloads"].each do |workload|
+            expect(workload["ops_per_sec"] > 0).to eq(true)
+            expect(workload["p50_ns"] <= workload["p99_ns"]).to eq(true)
+            expect(workload["p99_ns"] <= workload["p999_ns"]).to eq(true)
+        end
+        expect(File.exist?("test.db")).to eq(false)
+    end
+end